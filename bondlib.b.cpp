@@ -0,0 +1,288 @@
+// bondlib.b.cpp - benchmark bondlib
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "curve/tmx_pwflat.h"
+#include "curve/tmx_curve_crtp.h"
+#include "value/tmx_valuation.h"
+#include "value/tmx_valuation_batch.h"
+
+using namespace tmx;
+
+// Time f() in nanoseconds per call averaged over n calls.
+template<class F>
+inline double timeit(F&& f, size_t n)
+{
+	const auto t0 = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; ++i) {
+		f();
+	}
+	const auto t1 = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+}
+
+// Linear scan integral versus binary search on cumulative integrals.
+inline void pwflat_integral_bench()
+{
+	std::mt19937_64 rng(0);
+	const size_t m = 1 << 12; // query times
+
+	std::printf("pwflat::integral ns/call\n%8s %10s %10s\n", "knots", "scan", "search");
+	for (size_t n : { 2, 4, 8, 16, 32, 64, 128, 256, 512 }) {
+		std::vector<double> t(n), f(n), I(n), u(m);
+		std::uniform_real_distribution<double> r(0.01, 0.05);
+		for (size_t i = 0; i < n; ++i) {
+			t[i] = 30. * (i + 1) / n;
+			f[i] = r(rng);
+		}
+		pwflat::integrals(n, t.data(), f.data(), I.data());
+		std::uniform_real_distribution<double> du(0., t.back());
+		for (auto& ui : u) {
+			ui = du(rng);
+		}
+
+		volatile double s = 0;
+		size_t j = 0;
+		const double scan = timeit([&] {
+			s = s + pwflat::integral(u[j++ % m], n, t.data(), f.data());
+			}, 100 * m);
+		const double search = timeit([&] {
+			s = s + pwflat::integral(u[j++ % m], n, t.data(), f.data(), I.data());
+			}, 100 * m);
+
+		std::printf("%8zu %10.2f %10.2f\n", n, scan, search);
+	}
+}
+
+// OAS of a 30 year semiannual bond using virtual and static dispatch curves.
+inline void oas_bench()
+{
+	const size_t n = 60; // knots
+	std::vector<double> t(n), f(n);
+	for (size_t i = 0; i < n; ++i) {
+		t[i] = 30. * (i + 1) / n;
+		f[i] = 0.03 + 0.01 * t[i] / 30;
+	}
+	const curve::pwflat<> f_(n, t.data(), f.data());
+
+	const size_t m = 60; // cash flows
+	std::vector<double> u(m), c(m);
+	for (size_t j = 0; j < m; ++j) {
+		u[j] = 0.5 * (j + 1);
+		c[j] = 0.025;
+	}
+	c.back() += 1;
+	const auto i = instrument::iterable(fms::iterable::make_interval(u), fms::iterable::make_interval(c));
+	const double p = value::present(i, curve::constant(0.045));
+
+	volatile double s = 0;
+	const double virt = timeit([&] {
+		s = s + value::oas(i, f_, p);
+		}, 1000);
+	const double stat = timeit([&] {
+		s = s + value::oas(i, curve::crtp::pwflat(f_), p);
+		}, 1000);
+
+	std::printf("value::oas ns/call\n%10s %10s\n%10.0f %10.0f\n", "virtual", "crtp", virt, stat);
+}
+
+// Portfolio value and its gradient with respect to every knot using a tape.
+inline void adjoint_bench()
+{
+	const size_t n = 60; // knots
+	std::vector<double> t(n), f(n);
+	for (size_t i = 0; i < n; ++i) {
+		t[i] = 30. * (i + 1) / n;
+		f[i] = 0.03 + 0.01 * t[i] / 30;
+	}
+	const curve::pwflat<> f_(n, t.data(), f.data());
+
+	const size_t m = 1000; // bonds
+	std::vector<double> u(60), c(60 * m);
+	for (size_t j = 0; j < u.size(); ++j) {
+		u[j] = 0.5 * (j + 1);
+	}
+	using namespace fms::iterable;
+	using I = decltype(instrument::iterable(take(make_interval(u), 1), take(drop(make_interval(c), 0), 1)));
+	std::vector<I> is;
+	for (size_t k = 0; k < m; ++k) {
+		const size_t l = 2 * (1 + k % 30); // cash flows
+		const auto ck = c.begin() + 60 * k;
+		std::fill(ck, ck + l, 0.02 + 0.0001 * (k % 50));
+		ck[l - 1] += 1;
+		is.push_back(instrument::iterable(take(make_interval(u), l), take(drop(make_interval(c), 60 * k), l)));
+	}
+
+	volatile double s = 0;
+	const double pv = timeit([&] {
+		double v = 0;
+		for (const auto& i : is) {
+			v += value::present(i, f_);
+		}
+		s = s + v;
+		}, 100);
+
+	using A = math::adjoint<>;
+	math::tape<> tape;
+	const double grad = timeit([&] {
+		tape.clear();
+		std::vector<A> r(n);
+		for (size_t i = 0; i < n; ++i) {
+			r[i] = A::variable(f[i]);
+		}
+		const curve::pwflat<double, A> g(n, t.data(), r.data());
+		A v = 0;
+		for (const auto& i : is) {
+			v += value::present(i, g);
+		}
+		tape.gradient(v);
+		s = s + tape.derivative(r[0]);
+		}, 100);
+
+	std::printf("portfolio value us/call\n%10s %10s %10s\n%10.0f %10.0f %10.1f\n",
+		"present", "gradient", "ratio", pv / 1000, grad / 1000, grad / pv);
+}
+
+// Yields of many bonds one at a time and in lanes.
+// Bullet bonds have regular schedules and amortizing bonds do not.
+inline void yield_batch_bench()
+{
+	std::printf("value::yield ns/bond\n%10s %10s %10s\n", "bonds", "scalar", "batch");
+	for (bool amortizing : { false, true }) {
+		const size_t m = 10000; // bonds
+		std::vector<size_t> o{ 0 };
+		std::vector<double> u, c, p;
+		for (size_t j = 0; j < m; ++j) {
+			const size_t n = 2 + (j * 37) % 59; // cash flows
+			const double y = 0.01 + 0.0001 * (j % 300);
+			double pv = 0;
+			for (size_t k = 1; k <= n; ++k) {
+				u.push_back(0.5 * k);
+				c.push_back(amortizing ? (1 + 0.02 * (n + 1 - k)) / n : 0.02 + (k == n)); // interest on the outstanding balance
+				pv += c.back() * std::exp(-y * u.back());
+			}
+			o.push_back(u.size());
+			p.push_back(pv);
+		}
+		const instrument::columns<> cf{ std::span<const size_t>(o), std::span<const double>(u), std::span<const double>(c) };
+		std::vector<double> y(m);
+
+		using namespace fms::iterable;
+		using I = decltype(instrument::iterable(take(drop(make_interval(u), 0), 1), take(drop(make_interval(c), 0), 1)));
+		std::vector<I> is;
+		for (size_t j = 0; j < m; ++j) {
+			is.push_back(instrument::iterable(take(drop(make_interval(u), o[j]), cf.size(j)), take(drop(make_interval(c), o[j]), cf.size(j))));
+		}
+
+		volatile double s = 0;
+		const double one = timeit([&] {
+			for (size_t j = 0; j < m; ++j) {
+				s = s + value::yield(is[j], p[j]);
+			}
+			}, 10);
+		const double lanes = timeit([&] {
+			value::yield(cf, std::span<const double>(p), std::span<double>(y));
+			s = s + y[0];
+			}, 10);
+
+		std::printf("%10s %10.0f %10.0f\n", amortizing ? "amortizing" : "bullet", one / m, lanes / m);
+	}
+}
+
+// OAS of many bonds one at a time, in lanes, and in lanes warm started after a curve move.
+inline void oas_batch_bench()
+{
+	const size_t n = 60; // knots
+	std::vector<double> t(n), f(n), f1(n);
+	for (size_t i = 0; i < n; ++i) {
+		t[i] = 30. * (i + 1) / n;
+		f[i] = 0.03 + 0.01 * t[i] / 30;
+		f1[i] = f[i] + 0.0001;
+	}
+	const curve::pwflat<> D(n, t.data(), f.data());
+	const curve::pwflat<> D1(n, t.data(), f1.data());
+
+	const size_t m = 2000; // bonds
+	std::vector<size_t> o{ 0 };
+	std::vector<double> u, c, p;
+	for (size_t j = 0; j < m; ++j) {
+		const size_t k_ = 2 + j % 59; // cash flows
+		const double y = 0.03 + 0.0001 * (j % 300);
+		double pv = 0;
+		for (size_t k = 1; k <= k_; ++k) {
+			u.push_back(0.5 * k);
+			c.push_back(0.02 + (k == k_));
+			pv += c.back() * std::exp(-y * u.back());
+		}
+		o.push_back(u.size());
+		p.push_back(pv);
+	}
+	const instrument::columns<> cf{ std::span<const size_t>(o), std::span<const double>(u), std::span<const double>(c) };
+
+	using namespace fms::iterable;
+	using I = decltype(instrument::iterable(take(drop(make_interval(u), 0), 1), take(drop(make_interval(c), 0), 1)));
+	std::vector<I> is;
+	for (size_t j = 0; j < m; ++j) {
+		is.push_back(instrument::iterable(take(drop(make_interval(u), o[j]), cf.size(j)), take(drop(make_interval(c), o[j]), cf.size(j))));
+	}
+
+	volatile double s_ = 0;
+	const double one = timeit([&] {
+		for (size_t j = 0; j < m; ++j) {
+			s_ = s_ + value::oas(is[j], D, p[j]);
+		}
+		}, 10);
+	std::vector<double> s(m);
+	const double cold = timeit([&] {
+		std::fill(s.begin(), s.end(), 0.);
+		value::oas(cf, D, std::span<const double>(p), std::span<double>(s));
+		}, 10);
+	const double warm = timeit([&] {
+		value::oas(cf, D1, std::span<const double>(p), std::span<double>(s));
+		value::oas(cf, D, std::span<const double>(p), std::span<double>(s));
+		}, 10) / 2;
+
+	std::printf("value::oas ns/bond\n%10s %10s %10s\n%10.0f %10.0f %10.0f\n", "scalar", "batch", "warm", one / m, cold / m, warm / m);
+}
+
+// Monthly coupons on curves with annual knots and with 5 knots: every cash flow versus segment-wise series.
+inline void regular_pwflat_bench()
+{
+	std::vector<double> u, c;
+	for (size_t k = 1; k <= 360; ++k) {
+		u.push_back(k / 12.);
+		c.push_back(0.005);
+	}
+	const auto i = instrument::iterable(fms::iterable::make_interval(u), fms::iterable::make_interval(c));
+	const auto r = *instrument::make_regular(i);
+
+	std::printf("value::risk 360 cash flows ns/call\n%10s %10s %10s\n", "knots", "flows", "series");
+	for (size_t n : { 30, 5 }) {
+		std::vector<double> t, f;
+		for (size_t k = 1; k <= n; ++k) {
+			t.push_back(k * 30. / n);
+			f.push_back(0.02 + 0.001 * k);
+		}
+		const curve::pwflat<> D(t.size(), t.data(), f.data());
+
+		volatile double s = 0;
+		const double flows = timeit([&] { s = s + value::risk(i, D).duration; }, 10000);
+		const double series = timeit([&] { s = s + value::risk(r, D).duration; }, 10000);
+
+		std::printf("%10zu %10.0f %10.0f\n", n, flows, series);
+	}
+}
+
+int main()
+{
+	pwflat_integral_bench();
+	oas_bench();
+	adjoint_bench();
+	yield_batch_bench();
+	oas_batch_bench();
+	regular_pwflat_bench();
+
+	return 0;
+}
@@ -2,6 +2,9 @@
 #include <cassert>
 //#include "tmx_monoid.h"
 #include "math/tmx_math_hypergeometric.h"
+#include "math/tmx_adjoint.h"
+#include "math/tmx_dual.h"
+#include "math/tmx_hyperdual.h"
 #include "date/tmx_date_periodic.h"
 #include "variate/tmx_variate_normal.h"
 #include "value/tmx_option.h"
@@ -9,8 +12,16 @@
 #include "date/tmx_date_business_day.h"
 #include "curve/tmx_curve_pwflat.h"
 #include "curve/tmx_curve.h"
+#include "curve/tmx_curve_crtp.h"
 #include "instrument/tmx_instrument.h"
+#include "instrument/tmx_instrument_columns.h"
+#include "instrument/tmx_instrument_fixed.h"
+#include "instrument/tmx_instrument_regular.h"
+#include "instrument/tmx_instrument_table.h"
+#include "instrument/tmx_instrument_portfolio.h"
+#include "instrument/tmx_instrument_view.h"
 #include "value/tmx_valuation.h"
+#include "value/tmx_valuation_batch.h"
 #include "security/tmx_bond.h"
 #include "curve/tmx_curve_bootstrap.h"
 //#include "tmx_muni.h"
@@ -23,6 +34,10 @@ using namespace tmx;
 #ifdef _DEBUG
 
 int test_hypergeometric = math::hypergeometric_test();
+int test_math_dual = math::dual_test();
+int test_math_adjoint = math::adjoint_test();
+int test_math_hyperdual = math::hyperdual_test();
+int test_root1d_newton = root1d::newton_test();
 
 // variate/valuation
 int test_variate_normal = variate::normal<>::test();
@@ -34,7 +49,10 @@ int test_curve_constant = curve::constant_test();
 int test_curve_bump = curve::bump_test();
 int test_bump = curve::bump_test();
 int test_translate = curve::translate_test();
+int test_curve_crtp = curve::crtp::curve_test();
 
+int test_pwflat_integrals = pwflat::integrals_test();
+int test_pwflat_cursor = pwflat::cursor_test();
 int test_pwflat = curve::pwflat_test();
 //int test_tmx_monotonic = tmx::monotonic_test();
 //int test_pwflat_curve_view = pwflat::view<>::test();
@@ -48,6 +66,15 @@ int test_pwflat = curve::pwflat_test();
 int test_security_bond = security::bond_test();
 //int test_muni_fit = muni::fit_test();
 int test_valuation = value::valuation_test();
+int test_instrument_columns = instrument::columns_test();
+int test_instrument_regular = instrument::regular_test();
+int test_instrument_table = instrument::table_test();
+int test_instrument_portfolio = instrument::portfolio_test();
+int test_instrument_view = instrument::view_test();
+int test_yield_batch = value::yield_batch_test();
+int test_risk_batch = value::risk_batch_test();
+int test_oas_batch = value::oas_batch_test();
+int test_curve_bootstrap = curve::bootstrap_test();
 #endif // _DEBUG
 
 int bootstrap_test()
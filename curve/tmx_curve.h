@@ -3,14 +3,42 @@
 #ifdef _DEBUG
 #include<cassert>
 #endif // _DEBUG
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <concepts>
 #include <limits>
+#include <span>
+#include <vector>
 #include "ensure.h"
 #include "math/tmx_math_limits.h"
 
 namespace tmx::curve {
 
+	// Size of stack buffers used by batch evaluation of composite curves.
+	constexpr size_t batch_size = 64;
+
+	// Call op(u_, v_) on consecutive chunks of at most batch_size elements.
+	template<class T, class F, class Op>
+	inline void batch(std::span<const T> u, std::span<F> v, Op&& op)
+	{
+		for (size_t i = 0; i < u.size(); i += batch_size) {
+			const size_t n = std::min(batch_size, u.size() - i);
+			op(u.subspan(i, n), v.subspan(i, n));
+		}
+	}
+
+	// Curves having forward, integral, and discount at a time.
+	// Satisfied by curve::interface subclasses and curve::crtp curves.
+	template<class C>
+	concept forward_curve = requires(const C& c, typename C::time_type u) {
+		{ c.forward(u) } -> std::convertible_to<typename C::rate_type>;
+		{ c.integral(u) } -> std::convertible_to<typename C::rate_type>;
+		{ c.discount(u) } -> std::convertible_to<typename C::rate_type>;
+	};
+
 	// Subclasses implement _value and _integral.
+	// Batch versions taking spans default to calling these for each time.
 	// Handle extrapolation by f after t at the interface level.
 	template<class T = double, class F = double>
 	class interface {
@@ -39,7 +67,9 @@ namespace tmx::curve {
 		// Price of one unit received at time u.
 		constexpr F discount(T u, T t = math::infinity<T>, F f = math::NaN<F>) const
 		{
-			return u < 0 ? math::NaN<F> : std::exp(-integral(u, t, f));
+			using std::exp; // or exp found by argument dependent lookup
+
+			return u < 0 ? math::NaN<F> : exp(-integral(u, t, f));
 		}
 
 		// Spot/yield is the average of the forward over [0, u].
@@ -49,9 +79,83 @@ namespace tmx::curve {
 			return u < 0 ? math::NaN<F> : u < math::sqrt_epsilon<T> ? forward(u, t, f) : integral(u, t, f) / u;
 		}
 
+		// Append times where the forward can jump to t.
+		// Return false if the curve is not piecewise flat.
+		bool breaks(std::vector<T>& t) const
+		{
+			return _breaks(t);
+		}
+
+		// Forward at times u into v.
+		void forward(std::span<const T> u, std::span<F> v, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			ENSURE(u.size() == v.size());
+
+			_forward(u, v);
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = u[i] < 0 ? math::NaN<F> : u[i] <= t ? v[i] : f;
+			}
+		}
+
+		// Integral from 0 to u[i] of forward into v[i].
+		void integral(std::span<const T> u, std::span<F> v, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			ENSURE(u.size() == v.size());
+
+			_integral(u, v);
+			if (t != math::infinity<T>) {
+				const F It = _integral(t);
+				for (size_t i = 0; i < u.size(); ++i) {
+					if (u[i] > t) {
+						v[i] = It + f * (u[i] - t);
+					}
+				}
+			}
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = u[i] < 0 ? math::NaN<F> : u[i] == 0 ? 0 : v[i];
+			}
+		}
+
+		// Discount at times u into v.
+		void discount(std::span<const T> u, std::span<F> v, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			using std::exp;
+
+			integral(u, v, t, f);
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = exp(-v[i]);
+			}
+		}
+
+		// Spot at times u into v.
+		void spot(std::span<const T> u, std::span<F> v, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			integral(u, v, t, f);
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = u[i] < math::sqrt_epsilon<T> ? forward(u[i], t, f) : v[i] / u[i];
+			}
+		}
+
 	private:
 		constexpr virtual F _forward(T u) const = 0;
 		constexpr virtual F _integral(T u) const = 0;
+
+		virtual void _forward(std::span<const T> u, std::span<F> v) const
+		{
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = _forward(u[i]);
+			}
+		}
+		virtual void _integral(std::span<const T> u, std::span<F> v) const
+		{
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = _integral(u[i]);
+			}
+		}
+		virtual bool _breaks(std::vector<T>&) const
+		{
+			return false;
+		}
 	};
 
 	// Provide t and f where forward(u) = f for u > t.
@@ -73,6 +177,25 @@ namespace tmx::curve {
 		{
 			return f.integral(u, _t, _f);
 		}
+		void _forward(std::span<const T> u, std::span<F> v) const override
+		{
+			f.forward(u, v, _t, _f);
+		}
+		void _integral(std::span<const T> u, std::span<F> v) const override
+		{
+			f.integral(u, v, _t, _f);
+		}
+		bool _breaks(std::vector<T>& t) const override
+		{
+			const size_t n = t.size();
+			if (!f.breaks(t)) {
+				return false;
+			}
+			t.erase(std::remove_if(t.begin() + n, t.end(), [this](T u) { return u >= _t; }), t.end());
+			t.push_back(_t);
+
+			return true;
+		}
 	};
 
 	// Constant curve.
@@ -92,6 +215,20 @@ namespace tmx::curve {
 		{
 			return f * u;
 		}
+		void _forward(std::span<const T>, std::span<F> v) const override
+		{
+			std::fill(v.begin(), v.end(), f);
+		}
+		void _integral(std::span<const T> u, std::span<F> v) const override
+		{
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = f * u[i];
+			}
+		}
+		bool _breaks(std::vector<T>&) const override
+		{
+			return true;
+		}
 	};
 #ifdef _DEBUG
 	inline int constant_test()
@@ -105,6 +242,27 @@ namespace tmx::curve {
 			assert(c.spot(0.) == 1);
 			assert(c.spot(1.) == 1);
 		}
+		{
+			curve::constant c(.05);
+			const double u[] = { -1, 0, 0.5, 1, 2 };
+			double v[5];
+			c.forward(u, v);
+			for (int i = 0; i < 5; ++i) {
+				assert(math::isnan(v[i]) ? math::isnan(c.forward(u[i])) : v[i] == c.forward(u[i]));
+			}
+			c.integral(u, v);
+			for (int i = 0; i < 5; ++i) {
+				assert(math::isnan(v[i]) ? math::isnan(c.integral(u[i])) : v[i] == c.integral(u[i]));
+			}
+			c.discount(u, v, 1., .1);
+			for (int i = 0; i < 5; ++i) {
+				assert(math::isnan(v[i]) ? math::isnan(c.discount(u[i], 1., .1)) : v[i] == c.discount(u[i], 1., .1));
+			}
+			c.spot(u, v);
+			for (int i = 0; i < 5; ++i) {
+				assert(math::isnan(v[i]) ? math::isnan(c.spot(u[i])) : v[i] == c.spot(u[i]));
+			}
+		}
 
 		return 0;
 	}
@@ -134,6 +292,25 @@ namespace tmx::curve {
 		{
 			return s * (std::min(u, t1) - t0) * (u >= t0);
 		}
+		void _forward(std::span<const T> u, std::span<F> v) const override
+		{
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = s * (t0 <= u[i]) * (u[i] <= t1);
+			}
+		}
+		void _integral(std::span<const T> u, std::span<F> v) const override
+		{
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = s * (std::min(u[i], t1) - t0) * (u[i] >= t0);
+			}
+		}
+		bool _breaks(std::vector<T>& t) const override
+		{
+			t.push_back(t0);
+			t.push_back(t1);
+
+			return true;
+		}
 	};
 #ifdef _DEBUG
 	inline int bump_test()
@@ -148,6 +325,19 @@ namespace tmx::curve {
 			assert(b.integral(1) == 0);
 			assert(b.integral(2) == 0.5);
 		}
+		{
+			bump b(0.5, 1., 2.);
+			const double u[] = { 0.9, 1, 1.5, 2, 2.1 };
+			double v[5];
+			b.forward(u, v);
+			for (int i = 0; i < 5; ++i) {
+				assert(v[i] == b.forward(u[i]));
+			}
+			b.integral(u, v);
+			for (int i = 0; i < 5; ++i) {
+				assert(v[i] == b.integral(u[i]));
+			}
+		}
 
 		return 0;
 	}
@@ -175,6 +365,42 @@ namespace tmx::curve {
 		{
 			return f.integral(u + t) - f.integral(t);
 		}
+		void _forward(std::span<const T> u, std::span<F> v) const override
+		{
+			batch(u, v, [this](std::span<const T> u_, std::span<F> v_) {
+				std::array<T, batch_size> ut;
+				for (size_t i = 0; i < u_.size(); ++i) {
+					ut[i] = u_[i] + t;
+				}
+				f.forward(std::span<const T>(ut.data(), u_.size()), v_);
+			});
+		}
+		void _integral(std::span<const T> u, std::span<F> v) const override
+		{
+			const F It = f.integral(t);
+			batch(u, v, [this](std::span<const T> u_, std::span<F> v_) {
+				std::array<T, batch_size> ut;
+				for (size_t i = 0; i < u_.size(); ++i) {
+					ut[i] = u_[i] + t;
+				}
+				f.integral(std::span<const T>(ut.data(), u_.size()), v_);
+			});
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] -= It;
+			}
+		}
+		bool _breaks(std::vector<T>& t) const override
+		{
+			const size_t n = t.size();
+			if (!f.breaks(t)) {
+				return false;
+			}
+			for (size_t i = n; i < t.size(); ++i) {
+				t[i] -= this->t;
+			}
+
+			return true;
+		}
 	};
 #ifdef _DEBUG
 	inline int translate_test()
@@ -207,6 +433,32 @@ namespace tmx::curve {
 		{
 			return f.integral(u) + g.integral(u);
 		}
+		void _forward(std::span<const T> u, std::span<F> v) const override
+		{
+			batch(u, v, [this](std::span<const T> u_, std::span<F> v_) {
+				std::array<F, batch_size> w;
+				f.forward(u_, v_);
+				g.forward(u_, std::span<F>(w.data(), u_.size()));
+				for (size_t i = 0; i < u_.size(); ++i) {
+					v_[i] += w[i];
+				}
+			});
+		}
+		void _integral(std::span<const T> u, std::span<F> v) const override
+		{
+			batch(u, v, [this](std::span<const T> u_, std::span<F> v_) {
+				std::array<F, batch_size> w;
+				f.integral(u_, v_);
+				g.integral(u_, std::span<F>(w.data(), u_.size()));
+				for (size_t i = 0; i < u_.size(); ++i) {
+					v_[i] += w[i];
+				}
+			});
+		}
+		bool _breaks(std::vector<T>& t) const override
+		{
+			return f.breaks(t) && g.breaks(t);
+		}
 	};
 	// Shift curve rates by spread s.
 	template<class T = double, class F = double>
@@ -231,6 +483,18 @@ namespace tmx::curve {
 		{
 			return c.integral(u);
 		}
+		void _forward(std::span<const T> u, std::span<F> v) const override
+		{
+			c.forward(u, v);
+		}
+		void _integral(std::span<const T> u, std::span<F> v) const override
+		{
+			c.integral(u, v);
+		}
+		bool _breaks(std::vector<T>& t) const override
+		{
+			return c.breaks(t);
+		}
 	};
 
 } // namespace tmx::curve
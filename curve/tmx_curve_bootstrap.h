@@ -3,23 +3,45 @@
 #ifdef _DEBUG
 #include <cassert>
 #endif
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
 #include "instrument/tmx_instrument.h"
 #include "curve/tmx_curve_pwflat.h"
 #include "value/tmx_valuation.h"
+#include "math/tmx_adjoint.h"
 #include "math/tmx_math_limits.h"
 
 namespace tmx::curve {
 
-	// bootstrap1 - cash deposit
-	// bootstrap2 - forward rate agreement
+	// Extrapolated forward after _t for a single cash flow c at u > _t given
+	// present value p0 of cash flows at or before _t and price p.
+	// p = p0 + D(_t) c exp(-f_ (u - _t))
+	template<class T = double, class F = double>
+	inline F bootstrap_tail(T u, F c, const curve::interface<T, F>& f, T _t, F p = 1, F p0 = 0)
+	{
+		const F x = (p - p0) / (f.discount(_t) * c);
+
+		return x > 0 ? -std::log(x) / (u - _t) : math::NaN<F>;
+	}
 
 	// Bootstrap a single instrument given last time on curve and optional initial forward rate guess.
 	// Return point on the curve repricing the instrument.
+	// If n is not null it is set to the number of present value evaluations.
 	template<class IU, class IC, class T = double, class F = double>
 	inline std::pair<T, F> bootstrap0(instrument::iterable<IU, IC> i, const curve::interface<T, F>& f,
-		T _t, F _f = math::NaN<F>, F p = 0)
+		T _t, F _f = math::NaN<F>, F p = 0, size_t* n = nullptr)
 	{
+		if (n) {
+			*n = 0;
+		}
+
 		const auto uc = i.last(); // last instrument cash flow
 		if (uc.u <= _t) {
 			return { math::NaN<T>, math::NaN<F> };
@@ -33,21 +55,140 @@ namespace tmx::curve {
 			_f = 0.01;
 		}
 
-		const auto vp = [i, &f, _t, p](F f_) { return value::present(i, extrapolate(f, _t, f_)) - p; };
-		
-		auto [f_, tol, n] = root1d::secant(_f, _f + 0.01).solve(vp);
+		// Cash flows at or before _t do not depend on the extrapolated forward.
+		F p0 = 0;
+		thread_local std::vector<instrument::cash_flow<T, F>> tail; // (u - _t, c) for u > _t
+		tail.clear();
+		while (i) {
+			const auto [u, c] = *i;
+			if (u <= _t) {
+				p0 += c * f.discount(u);
+			}
+			else {
+				tail.emplace_back(u - _t, c);
+			}
+			++i;
+		}
+		if (tail.size() == 1) {
+			return { uc.u, bootstrap_tail(static_cast<T>(uc.u), tail[0].c, f, _t, p, p0) };
+		}
+		const F Dt = f.discount(_t);
+
+		// Value p0 + D(_t) sum_{u > _t} c exp(-f_ (u - _t)) - p and
+		// derivative -D(_t) sum_{u > _t} (u - _t) c exp(-f_ (u - _t)).
+		const auto vdv = [p0, Dt, p](F f_) {
+			F pv = 0, dv = 0;
+			for (const auto& [u, c] : tail) {
+				const F cD = c * std::exp(-f_ * u);
+				pv += cD;
+				dv -= u * cD;
+			}
+
+			return std::pair(p0 + Dt * pv - p, Dt * dv);
+		};
+
+		auto [f_, tol, m] = root1d::newton(_f).solve(vdv);
+		if (n) {
+			*n += m;
+		}
+		if (std::isnan(f_)) {
+			const auto vp = [&vdv](F f_) { return vdv(f_).first; };
+			std::tie(f_, tol, m) = root1d::secant(_f, _f + 0.01).solve(vp);
+			if (n) {
+				*n += m + 1;
+			}
+		}
 		_f = f_;
 
 		return { uc.u, _f};
 	}
+	// bootstrap1 - cash deposit
+	// Deposit p at time 0 and receive c at time u > _t.
+	// Return point on the curve repricing the deposit.
+	template<class T = double, class F = double>
+	inline std::pair<T, F> bootstrap1(T u, F c, const curve::interface<T, F>& f, T _t, F p = 1)
+	{
+		if (u <= _t) {
+			return { math::NaN<T>, math::NaN<F> };
+		}
+
+		return { u, bootstrap_tail(u, c, f, _t, p) };
+	}
+
+	// bootstrap2 - forward rate agreement
+	// Pay 1 at time u0 and receive c at time u1 > _t for price p.
+	// Return point on the curve repricing the agreement.
+	template<class T = double, class F = double>
+	inline std::pair<T, F> bootstrap2(T u0, T u1, F c, const curve::interface<T, F>& f, T _t, F p = 0)
+	{
+		if (u1 <= _t or u1 <= u0) {
+			return { math::NaN<T>, math::NaN<F> };
+		}
+
+		if (u0 <= _t) {
+			return { u1, bootstrap_tail(u1, c, f, _t, p, -f.discount(u0)) };
+		}
+
+		// exp(f_ (u1 - u0)) = c at par
+		if (p == 0) {
+			return { u1, c > 0 ? std::log(c) / (u1 - u0) : math::NaN<F> };
+		}
+
+		T u[] = { u0, u1 };
+		F c_[] = { F(-1), c };
+
+		return bootstrap0(instrument::iterable(fms::iterable::array(u), fms::iterable::array(c_)), f, _t, math::NaN<F>, p);
+	}
+
+	// Derivative of instrument present value with respect to the rate on each segment
+	// (t[k-1], t[k]] of f extrapolated by _f after its last knot t[n-1].
+	// dv[k] = -sum_j c_j D(u_j) |(t[k-1], t[k]] ∩ (0, u_j]| for k <= n, where t[-1] = 0 and t[n] = infinity.
+	// One pass over the cash flows and knots using a cursor.
+	template<class IU, class IC, class T = double, class F = double>
+	inline std::vector<F> bootstrap_gradient(instrument::iterable<IU, IC> i, const std::vector<T>& t,
+		const curve::pwflat<T, F>& f, F _f)
+	{
+		ENSURE(t.size() == f.size());
+
+		std::vector<F> dv(t.size() + 1, F(0));
+		value::key_rate_durations(i, f.cursor(_f), std::span<const T>(t), std::span<F>(dv));
+
+		return dv;
+	}
+
 	// Bootstrap a piecewise flat curve from instruments and prices.
+	// If n is not null append the number of present value evaluations for each knot.
+	// If J is not null append the lower triangular Jacobian of knot rates with respect to prices
+	// packed by rows, J[k(k+1)/2 + j] = df[k]/dp[j] for j <= k.
 	template<fms::iterable::input_iterable I, fms::iterable::input_iterable P>
-	constexpr auto bootstrap(I is, P ps, double _t = 0, double _f = 0.03)
+		requires (!math::is_adjoint_v<std::remove_cvref_t<typename P::value_type>>)
+	constexpr auto bootstrap(I is, P ps, double _t = 0, double _f = 0.03, std::vector<size_t>* n = nullptr,
+		std::vector<double>* J = nullptr)
 	{
 		curve::pwflat<> f;
+		std::vector<double> t; // knot times
 		
 		while (is and ps) {
-			std::tie(_t, _f) = bootstrap0(*is, f, _t, _f, *ps);
+			size_t m = 0;
+			std::tie(_t, _f) = bootstrap0(*is, f, _t, _f, *ps, &m);
+			if (n) {
+				n->push_back(m);
+			}
+			if (J) {
+				// implicit differentiation of v_k(f[0], ..., f[k]) = p[k]
+				const size_t k = t.size();
+				const auto dv = bootstrap_gradient(*is, t, f, _f);
+				const size_t row = J->size();
+				J->resize(row + k + 1);
+				for (size_t j = 0; j <= k; ++j) {
+					double dvj = j == k ? 1 : 0;
+					for (size_t i = j; i < k; ++i) {
+						dvj -= dv[i] * (*J)[i * (i + 1) / 2 + j];
+					}
+					(*J)[row + j] = dvj / dv[k];
+				}
+			}
+			t.push_back(_t);
 			f.push_back(_t, _f);
 			++is;
 			++ps;
@@ -55,6 +196,175 @@ namespace tmx::curve {
 
 		return f;
 	}
+	// Bootstrap from adjoint prices on the active tape.
+	// Each knot rate is one node with partial derivatives given by the Jacobian.
+	template<fms::iterable::input_iterable I, fms::iterable::input_iterable P>
+		requires math::is_adjoint_v<std::remove_cvref_t<typename P::value_type>>
+	inline auto bootstrap(I is, P ps, double _t = 0, double _f = 0.03)
+	{
+		using A = std::remove_cvref_t<typename P::value_type>;
+		ENSURE(math::tape<double>::active() || !"bootstrap: no active tape");
+
+		std::vector<A> p;
+		for (auto p_ = ps; p_; ++p_) {
+			p.push_back(*p_);
+		}
+		std::vector<double> J;
+		const auto f = bootstrap(is, apply([](const A& a) { return a.value(); }, ps), _t, _f, nullptr, &J);
+
+		std::vector<double> t;
+		f.breaks(t);
+		std::vector<A> r;
+		auto f_ = f.rate();
+		for (size_t k = 0; k < t.size(); ++k, ++f_) {
+			const size_t row = k * (k + 1) / 2;
+			r.push_back(math::tape<double>::active()->record(*f_,
+				std::span<const A>(p.data(), k + 1), std::span<const double>(J.data() + row, k + 1)));
+		}
+
+		return curve::pwflat<double, A>(t.size(), t.data(), r.data());
+	}
+	// Bootstrap curves from independent instruments is[j] and prices ps[j] using threads.
+	// Result j is the curve for is[j] and ps[j] independent of scheduling.
+	template<fms::iterable::input_iterable I, fms::iterable::input_iterable P>
+	inline std::vector<curve::pwflat<>> bootstrap_batch(std::span<const I> is, std::span<const P> ps,
+		unsigned threads = std::thread::hardware_concurrency())
+	{
+		ENSURE(is.size() == ps.size());
+
+		const size_t n = is.size();
+		std::vector<curve::pwflat<>> f(n);
+		std::vector<std::exception_ptr> e(n);
+		std::atomic<size_t> next = 0;
+
+		const auto work = [&]() {
+			for (size_t j = next++; j < n; j = next++) {
+				try {
+					f[j] = bootstrap(is[j], ps[j]);
+				}
+				catch (...) {
+					e[j] = std::current_exception();
+				}
+			}
+		};
+
+		threads = std::clamp<unsigned>(threads, 1, static_cast<unsigned>(std::max<size_t>(n, 1)));
+		{
+			std::vector<std::jthread> pool;
+			for (unsigned k = 1; k < threads; ++k) {
+				pool.emplace_back(work);
+			}
+			work();
+		}
+		for (const auto& ej : e) {
+			if (ej) {
+				std::rethrow_exception(ej);
+			}
+		}
+
+		return f;
+	}
+
+	// Curve bootstrapped from instruments and prices that re-solves only
+	// knots at or after an instrument whose price changed.
+	template<class T = double, class F = double>
+	class bootstrapper {
+		std::vector<std::vector<T>> u; // instrument cash flow times
+		std::vector<std::vector<F>> c; // instrument cash flow amounts
+		std::vector<F> p; // instrument prices
+		std::vector<T> t_; // knot times
+		std::vector<F> f_; // knot rates
+		curve::pwflat<T, F> f;
+
+		auto cash_flows(size_t j) const
+		{
+			return instrument::iterable(fms::iterable::make_interval(u[j]), fms::iterable::make_interval(c[j]));
+		}
+		// Knot repricing i at price p_ after the knots on f using guess _f.
+		template<class I>
+		std::pair<T, F> solve(I i, F p_, F _f) const
+		{
+			const T _t = f.size() ? f.back().first : T(0);
+			const auto tf = bootstrap0(i, f, _t, _f, p_);
+			ENSURE(!math::isnan(tf.second) || !"bootstrapper: no knot reprices the instrument");
+
+			return tf;
+		}
+	public:
+		bootstrapper() = default;
+
+		size_t size() const
+		{
+			return p.size();
+		}
+		const curve::pwflat<T, F>& curve() const
+		{
+			return f;
+		}
+		F price(size_t j) const
+		{
+			return p[j];
+		}
+
+		// Add instrument with price p_ maturing after the last instrument and solve its knot.
+		// Nothing changes if the knot cannot be solved.
+		template<class IU, class IC>
+		bootstrapper& push_back(instrument::iterable<IU, IC> i, F p_)
+		{
+			std::vector<T> ui;
+			std::vector<F> ci;
+			while (i) {
+				const auto uc = *i;
+				ui.push_back(uc.u);
+				ci.push_back(uc.c);
+				++i;
+			}
+			const auto [t, f0] = solve(instrument::iterable(fms::iterable::make_interval(ui), fms::iterable::make_interval(ci)),
+				p_, size() ? f_.back() : math::NaN<F>);
+
+			u.push_back(std::move(ui));
+			c.push_back(std::move(ci));
+			p.push_back(p_);
+			t_.push_back(t);
+			f_.push_back(f0);
+			f.push_back(t, f0);
+
+			return *this;
+		}
+
+		// Update price of instrument j and re-solve knots j onward
+		// using the previous solution as the initial guess.
+		// Knots before j are kept. Nothing changes if a knot cannot be solved.
+		bootstrapper& update(size_t j, F p_)
+		{
+			ENSURE(j < size());
+
+			const F pj = p[j];
+			std::vector<T> t(size() - j);
+			std::vector<F> r(size() - j);
+			p[j] = p_;
+			f.truncate(j);
+			try {
+				for (size_t k = j; k < size(); ++k) {
+					std::tie(t[k - j], r[k - j]) = solve(cash_flows(k), p[k], f_[k]);
+					f.push_back(t[k - j], r[k - j]);
+				}
+			}
+			catch (...) {
+				p[j] = pj;
+				f.truncate(j);
+				for (size_t k = j; k < size(); ++k) {
+					f.push_back(t_[k], f_[k]);
+				}
+				throw;
+			}
+			std::copy(t.begin(), t.end(), t_.begin() + j);
+			std::copy(r.begin(), r.end(), f_.begin() + j);
+
+			return *this;
+		}
+	};
+
 #ifdef _DEBUG
 	inline int bootstrap_test()
 	{
@@ -70,9 +380,191 @@ namespace tmx::curve {
 			auto d = value::duration(zcb, extrapolate(f, 0., r));
 			assert(d == -1);
 			auto [_t, _f] = curve::bootstrap0(zcb, f, 0., 0.2, 1.);
-			assert(_t == 0);
+			assert(_t == 1);
 			assert(std::fabs(_f - r) <= math::sqrt_epsilon<double>);
 		}
+		{
+			// reprice par coupon bonds
+			const double r = 0.03;
+			const curve::constant<> c(r);
+			double u[] = { 0.5, 1, 1.5, 2, 2.5, 3 };
+			double cf[6];
+			curve::pwflat<> f;
+			double _t = 0, _f = 0.01;
+			for (size_t n = 1; n <= 6; ++n) {
+				std::fill(cf, cf + n, 0.025);
+				cf[n - 1] += 1;
+				const auto i = instrument::iterable(take(array(u), n), take(array(cf), n));
+				const double p = value::present(i, c);
+				size_t m;
+				std::tie(_t, _f) = curve::bootstrap0(i, f, _t, _f, p, &m);
+				assert(m <= 4);
+				f.push_back(_t, _f);
+				assert(std::fabs(value::present(i, f) - p) <= math::sqrt_epsilon<double>);
+				assert(std::fabs(_f - r) <= math::sqrt_epsilon<double>);
+			}
+		}
+		{
+			// deposit then forward rate agreements
+			const double r = 0.04;
+			curve::pwflat<> f;
+			auto [t1, f1] = curve::bootstrap1(0.25, 1 + r * 0.25, f, 0.);
+			assert(t1 == 0.25);
+			assert(std::fabs(f.discount(0.) * (1 + r * 0.25) * std::exp(-f1 * 0.25) - 1) <= math::epsilon<double>);
+			f.push_back(t1, f1);
+
+			auto [t2, f2] = curve::bootstrap2(0.25, 0.5, 1 + r * 0.25, f, t1);
+			assert(t2 == 0.5);
+			assert(std::fabs(f2 - std::log(1 + r * 0.25) / 0.25) <= math::sqrt_epsilon<double>);
+			f.push_back(t2, f2);
+
+			auto [t3, f3] = curve::bootstrap2(0.75, 1., 1 + r * 0.25, f, t2);
+			assert(t3 == 1);
+			assert(std::fabs(f3 - std::log(1 + r * 0.25) / 0.25) <= math::sqrt_epsilon<double>);
+
+			// same as solving
+			const double p = 0.001;
+			auto [t4, f4] = curve::bootstrap2(0.25, 0.5, 1 + r * 0.25, f, t1, p);
+			double u[] = { 0.25, 0.5 };
+			double c[] = { -1, 1 + r * 0.25 };
+			const auto fra = instrument::iterable(array(u), array(c));
+			assert(std::fabs(value::present(fra, curve::extrapolate(f, t1, f4)) - p) <= math::sqrt_epsilon<double>);
+			auto [t5, f5] = curve::bootstrap2(0.75, 1., 1 + r * 0.25, f, t2, p);
+			assert(t5 == 1);
+			double u_[] = { 0.75, 1 };
+			const auto fra_ = instrument::iterable(array(u_), array(c));
+			assert(std::fabs(value::present(fra_, curve::extrapolate(f, t2, f5)) - p) <= math::sqrt_epsilon<double>);
+		}
+		{
+			// Jacobian of knot rates with respect to prices
+			const curve::constant<> c(0.03);
+			double u[] = { 0.5, 1, 1.5, 2, 2.5, 3 };
+			double cf[6][6];
+			using I = decltype(instrument::iterable(take(array(u), 1), take(array(cf[0]), 1)));
+			I is[6];
+			double ps[6];
+			for (size_t n = 1; n <= 6; ++n) {
+				std::fill(cf[n - 1], cf[n - 1] + n, 0.025);
+				cf[n - 1][n - 1] += 1;
+				is[n - 1] = instrument::iterable(take(array(u), n), take(array(cf[n - 1]), n));
+				ps[n - 1] = value::present(is[n - 1], c);
+			}
+			std::vector<double> J;
+			const auto f = curve::bootstrap(array(is), array(ps), 0., 0.03, nullptr, &J);
+			assert(J.size() == 6 * 7 / 2);
+			const double h = 1e-6;
+			for (size_t j = 0; j < 6; ++j) {
+				ps[j] += h;
+				const auto f_ = curve::bootstrap(array(is), array(ps));
+				ps[j] -= h;
+				auto r = f.rate();
+				auto r_ = f_.rate();
+				for (size_t k = 0; k < 6; ++k, ++r, ++r_) {
+					const double dr = (*r_ - *r) / h;
+					assert(std::fabs(dr - (j <= k ? J[k * (k + 1) / 2 + j] : 0)) <= 1e-4);
+				}
+			}
+
+			// reverse mode gradient of a bond value with respect to prices
+			using A = math::adjoint<>;
+			math::tape<> tape;
+			A pa[6];
+			for (size_t j = 0; j < 6; ++j) {
+				pa[j] = A::variable(ps[j]);
+			}
+			const auto g = curve::bootstrap(array(is), array(pa));
+			double cb[] = { .02, .02, .02, .02, .02, 1.02 };
+			const auto b = instrument::iterable(array(u), array(cb));
+			const A v = value::present(b, g);
+			assert(std::fabs(v.value() - value::present(b, f)) <= 1e-12);
+			tape.gradient(v);
+			for (size_t j = 0; j < 6; ++j) {
+				ps[j] += h;
+				const double dv = (value::present(b, curve::bootstrap(array(is), array(ps))) - v.value()) / h;
+				ps[j] -= h;
+				assert(std::fabs(tape.derivative(pa[j]) - dv) <= 1e-4);
+			}
+		}
+		{
+			// parallel batch matches sequential
+			double u[] = { 0.5, 1, 1.5, 2, 2.5, 3 };
+			double cf[6][6];
+			using I = decltype(instrument::iterable(take(array(u), 1), take(array(cf[0]), 1)));
+			I is[6];
+			for (size_t n = 1; n <= 6; ++n) {
+				std::fill(cf[n - 1], cf[n - 1] + n, 0.025);
+				cf[n - 1][n - 1] += 1;
+				is[n - 1] = instrument::iterable(take(array(u), n), take(array(cf[n - 1]), n));
+			}
+			const size_t m = 17;
+			std::vector<double> ps(6 * m);
+			for (size_t j = 0; j < m; ++j) {
+				const curve::constant<> c(0.01 + 0.002 * j);
+				for (size_t k = 0; k < 6; ++k) {
+					ps[6 * j + k] = value::present(is[k], c);
+				}
+			}
+			using P = decltype(take(make_interval(ps), 6));
+			std::vector<decltype(array(is))> is_(m, array(is));
+			std::vector<P> ps_;
+			for (size_t j = 0; j < m; ++j) {
+				ps_.push_back(take(drop(make_interval(ps), 6 * j), 6));
+			}
+			const auto fs = curve::bootstrap_batch(std::span<const decltype(array(is))>(is_), std::span<const P>(ps_), 4);
+			assert(fs.size() == m);
+			for (size_t j = 0; j < m; ++j) {
+				assert(fs[j] == curve::bootstrap(is_[j], ps_[j]));
+			}
+		}
+		{
+			const curve::constant<> c(0.03);
+			double u[] = { 0.5, 1, 1.5, 2, 2.5, 3 };
+			double cf[6][6];
+			curve::bootstrapper<> b;
+			for (size_t n = 1; n <= 6; ++n) {
+				std::fill(cf[n - 1], cf[n - 1] + n, 0.025);
+				cf[n - 1][n - 1] += 1;
+				const auto i = instrument::iterable(take(array(u), n), take(array(cf[n - 1]), n));
+				b.push_back(i, value::present(i, c));
+			}
+			assert(b.size() == 6);
+			const auto f = b.curve();
+
+			b.update(3, b.price(3) - 0.01);
+			const auto g = b.curve();
+			const double g_p4 = b.price(4);
+			assert(equal(g.time(), f.time()));
+			auto fr = f.rate();
+			auto gr = g.rate();
+			for (size_t k = 0; k < 3; ++k, ++fr, ++gr) {
+				assert(*fr == *gr);
+			}
+			assert(*gr > *fr);
+			for (size_t k = 3; k < 6; ++k) {
+				const auto i = instrument::iterable(take(array(u), k + 1), take(array(cf[k]), k + 1));
+				assert(std::fabs(value::present(i, g) - b.price(k)) <= math::sqrt_epsilon<double>);
+			}
+
+			// instruments no knot can reprice leave the bootstrapper unchanged
+			double u7[] = { 3.5 };
+			double c7[] = { 1 };
+			try {
+				b.push_back(instrument::iterable(array(u7), array(c7)), -1.);
+				assert(false);
+			}
+			catch (const std::runtime_error&) {
+			}
+			assert(b.size() == 6);
+			assert(b.curve().size() == 6);
+			try {
+				b.update(4, -1.);
+				assert(false);
+			}
+			catch (const std::runtime_error&) {
+			}
+			assert(b.curve() == g);
+			assert(b.price(4) == g_p4);
+		}
 
 		return 0;
 	}
@@ -0,0 +1,230 @@
+// tmx_curve_crtp.h - Curves using static dispatch that compose into one inlinable object.
+// Subclasses of crtp::base implement _forward and _integral without virtual calls.
+// Composites hold their curves by value so an expression like
+// extrapolate(pwflat(f), t, r) + s is a single type the compiler can inline.
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include "ensure.h"
+#include "math/tmx_math_limits.h"
+#include "curve/tmx_curve.h"
+#include "curve/tmx_curve_pwflat.h"
+
+namespace tmx::curve::crtp {
+
+	// Same invariants as curve::interface using C::_forward and C::_integral.
+	template<class C, class T = double, class F = double>
+	class base {
+		constexpr const C& self() const
+		{
+			return static_cast<const C&>(*this);
+		}
+	public:
+		using time_type = T;
+		using rate_type = F;
+
+		constexpr F forward(T u, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			return u < 0 ? math::NaN<F> : u <= t ? self()._forward(u) : f;
+		}
+		constexpr F operator()(T u, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			return forward(u, t, f);
+		}
+		constexpr F integral(T u, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			return u < 0 ? math::NaN<F> : u == 0 ? 0 : u <= t ? self()._integral(u) : self()._integral(t) + f * (u - t);
+		}
+		constexpr F discount(T u, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			using std::exp;
+
+			return u < 0 ? math::NaN<F> : exp(-integral(u, t, f));
+		}
+		constexpr F spot(T u, T t = math::infinity<T>, F f = math::NaN<F>) const
+		{
+			return u < 0 ? math::NaN<F> : u < math::sqrt_epsilon<T> ? forward(u, t, f) : integral(u, t, f) / u;
+		}
+	};
+
+	// Curves derived from crtp::base.
+	template<class C>
+	concept curve_type = std::derived_from<C, base<C, typename C::time_type, typename C::rate_type>>;
+
+	// Constant curve.
+	template<class T = double, class F = double>
+	class constant : public base<constant<T, F>, T, F> {
+		F f;
+	public:
+		constexpr constant(F f = 0)
+			: f(f)
+		{ }
+
+		constexpr F _forward(T) const
+		{
+			return f;
+		}
+		constexpr F _integral(T u) const
+		{
+			return f * u;
+		}
+	};
+
+	// s on [t0, t1], 0 elsewhere.
+	template<class T = double, class F = double>
+	class bump : public base<bump<T, F>, T, F> {
+		F s;
+		T t0, t1;
+	public:
+		constexpr bump(F s, T t0 = 0, T t1 = math::infinity<T>)
+			: s(s), t0(t0), t1(t1)
+		{
+			ENSURE(t0 <= t1);
+		}
+
+		constexpr F _forward(T u) const
+		{
+			return s * (t0 <= u) * (u <= t1);
+		}
+		constexpr F _integral(T u) const
+		{
+			return s * (std::min(u, t1) - t0) * (u >= t0);
+		}
+	};
+
+	// View of a curve::pwflat. Assumes lifetime of f.
+	template<class T = double, class F = double>
+	class pwflat : public base<pwflat<T, F>, T, F> {
+		const curve::pwflat<T, F>& f;
+	public:
+		constexpr pwflat(const curve::pwflat<T, F>& f)
+			: f(f)
+		{ }
+
+		// Qualified calls are not virtual.
+		constexpr F _forward(T u) const
+		{
+			return f.curve::pwflat<T, F>::_forward(u);
+		}
+		constexpr F _integral(T u) const
+		{
+			return f.curve::pwflat<T, F>::_integral(u);
+		}
+	};
+
+	// Provide t and f where forward(u) = f for u > t.
+	template<curve_type C>
+	class extrapolate : public base<extrapolate<C>, typename C::time_type, typename C::rate_type> {
+		using T = typename C::time_type;
+		using F = typename C::rate_type;
+		C f;
+		T _t;
+		F _f;
+	public:
+		constexpr extrapolate(const C& f, T _t = math::infinity<T>, F _f = math::NaN<F>)
+			: f(f), _t(_t), _f(_f)
+		{ }
+
+		constexpr F _forward(T u) const
+		{
+			return f.forward(u, _t, _f);
+		}
+		constexpr F _integral(T u) const
+		{
+			return f.integral(u, _t, _f);
+		}
+	};
+
+	// Shift curve forward by t.
+	template<curve_type C>
+	class translate : public base<translate<C>, typename C::time_type, typename C::rate_type> {
+		using T = typename C::time_type;
+		using F = typename C::rate_type;
+		C f;
+		T t;
+	public:
+		constexpr translate(const C& f, T t)
+			: f(f), t(t)
+		{ }
+
+		constexpr F _forward(T u) const
+		{
+			return f.forward(u + t);
+		}
+		constexpr F _integral(T u) const
+		{
+			return f.integral(u + t) - f.integral(t);
+		}
+	};
+
+	// Add two curves.
+	template<curve_type C, curve_type D>
+	class plus : public base<plus<C, D>, typename C::time_type, typename C::rate_type> {
+		using T = typename C::time_type;
+		using F = typename C::rate_type;
+		C f;
+		D g;
+	public:
+		constexpr plus(const C& f, const D& g)
+			: f(f), g(g)
+		{ }
+
+		constexpr F _forward(T u) const
+		{
+			return f.forward(u) + g.forward(u);
+		}
+		constexpr F _integral(T u) const
+		{
+			return f.integral(u) + g.integral(u);
+		}
+	};
+
+	// Add two curves.
+	template<curve_type C, curve_type D>
+	constexpr plus<C, D> operator+(const C& f, const D& g)
+	{
+		return plus<C, D>(f, g);
+	}
+	// Shift curve rates by spread s.
+	template<curve_type C>
+	constexpr auto operator+(const C& f, typename C::rate_type s)
+	{
+		return plus(f, constant<typename C::time_type, typename C::rate_type>(s));
+	}
+
+#ifdef _DEBUG
+	inline int curve_test()
+	{
+		{
+			constexpr crtp::constant c(1.);
+			static_assert(c.forward(0.) == 1);
+			static_assert(c.integral(2.) == 2);
+			static_assert(c.spot(1.) == 1);
+			static_assert((c + 2.).integral(2.) == 6);
+			static_assert((c + crtp::bump(.5, 1., 2.)).integral(3.) == 3.5);
+			static_assert(crtp::extrapolate(c, 1., 2.).integral(3.) == 5);
+			static_assert(crtp::translate(c + crtp::bump(.5, 1., 2.), 1.).integral(1.) == 1.5);
+		}
+		{
+			double t[] = { 1, 2, 3 };
+			double f[] = { .01, .02, .03 };
+			const curve::pwflat<> f_(3, t, f);
+			const auto e_ = curve::extrapolate(f_, 3., .04);
+			const auto g_ = curve::spread(e_, .01);
+			const auto g = crtp::extrapolate(crtp::pwflat(f_), 3., .04) + .01;
+			for (double u = 0; u < 5; u += 0.25) {
+				assert(g.forward(u) == g_.forward(u));
+				assert(g.integral(u) == g_.integral(u));
+				assert(g.discount(u) == g_.discount(u));
+			}
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
+} // namespace tmx::curve::crtp
@@ -1,8 +1,10 @@
 // tmx_curve_pwflat.h - Piecewise flat forward curve value type.
 #pragma once
+#include <algorithm>
 #include <compare>
 #include <stdexcept>
 #include <span>
+#include <utility>
 #include <vector>
 #include "ensure.h"
 #include "math/tmx_math_limits.h"
@@ -16,19 +18,32 @@ namespace tmx::curve {
 	class pwflat : public interface<T, F> {
 		std::vector<T> t_;
 		std::vector<F> f_;
+		std::vector<F> I_; // I_[i] = int_0^t_[i] f(s) ds
+		F _f = math::NaN<F>; // extrapolated rate
+
+		void integrals()
+		{
+			I_.resize(f_.size());
+			tmx::pwflat::integrals(t_.size(), t_.data(), f_.data(), I_.data());
+		}
 	public:
 		// constant curve
 		constexpr pwflat()
 		{ }
-		pwflat(size_t n, const T* t, const F* f)
-			: t_(t, t + n), f_(f, f + n)
+		constexpr explicit pwflat(F _f)
+			: _f(_f)
+		{ }
+		pwflat(size_t n, const T* t, const F* f, F _f = math::NaN<F>)
+			: t_(t, t + n), f_(f, f + n), _f(_f)
 		{
 			ENSURE(tmx::pwflat::monotonic(n, t) || clear());
+			integrals();
 		}
-		pwflat(std::span<T> t, std::span<F> f)
-			: t_(t.begin(), t.end()), f_(f.begin(), f.end())
+		pwflat(std::span<T> t, std::span<F> f, F _f = math::NaN<F>)
+			: t_(t.begin(), t.end()), f_(f.begin(), f.end()), _f(_f)
 		{
 			ENSURE (t_.size() == f_.size() || (!"pwflat: t and f must have the same size" || clear()));
+			integrals();
 		}
 		pwflat(const pwflat&) = default;
 		pwflat& operator=(const pwflat&) = default;
@@ -39,16 +54,58 @@ namespace tmx::curve {
 		// Equal values.
 		bool operator==(const pwflat& c) const
 		{
-			return t_ == c.t_ && f_ == c.f_;
+			return t_ == c.t_ && f_ == c.f_ && (_f == c._f || (math::isnan(_f) && math::isnan(c._f)));
 		}
 
 		F _forward(T u) const noexcept override
 		{
-			return tmx::pwflat::forward(u, t_.size(), t_.data(), f_.data());
+			return tmx::pwflat::forward(u, t_.size(), t_.data(), f_.data(), _f);
 		}
 		F _integral(T u) const noexcept override
 		{
-			return tmx::pwflat::integral(u, t_.size(), t_.data(), f_.data());
+			return tmx::pwflat::integral(u, t_.size(), t_.data(), f_.data(), I_.data(), _f);
+		}
+		void _forward(std::span<const T> u, std::span<F> v) const noexcept override
+		{
+			for (size_t i = 0; i < u.size(); ++i) {
+				v[i] = tmx::pwflat::forward(u[i], t_.size(), t_.data(), f_.data(), _f);
+			}
+		}
+		void _integral(std::span<const T> u, std::span<F> v) const noexcept override
+		{
+			if (std::is_sorted(u.begin(), u.end())) {
+				auto c = cursor();
+				for (size_t i = 0; i < u.size(); ++i) {
+					v[i] = c.integral(u[i]);
+				}
+			}
+			else {
+				for (size_t i = 0; i < u.size(); ++i) {
+					v[i] = tmx::pwflat::integral(u[i], t_.size(), t_.data(), f_.data(), I_.data(), _f);
+				}
+			}
+		}
+
+		// Evaluate at non-decreasing times in one pass over the knots.
+		tmx::pwflat::cursor<T, F> cursor() const
+		{
+			return tmx::pwflat::cursor<T, F>(t_.size(), t_.data(), f_.data(), _f);
+		}
+		// Rate after the last knot.
+		F extrapolation() const
+		{
+			return _f;
+		}
+		// Cursor using extrapolated rate f after the last knot.
+		tmx::pwflat::cursor<T, F> cursor(F f) const
+		{
+			return tmx::pwflat::cursor<T, F>(t_.size(), t_.data(), f_.data(), f);
+		}
+		bool _breaks(std::vector<T>& t) const override
+		{
+			t.insert(t.end(), t_.begin(), t_.end());
+
+			return true;
 		}
 
 		bool clear() noexcept
@@ -57,6 +114,7 @@ namespace tmx::curve {
 
 			t_.clear();
 			f_.clear();
+			I_.clear();
 
 			return empty;
 		}
@@ -77,6 +135,7 @@ namespace tmx::curve {
 		{
 			ENSURE(size() == 0 || t >= t_.back());
 
+			I_.push_back((size() ? I_.back() : F(0)) + f * (t - (size() ? t_.back() : T(0))));
 			t_.push_back(t);
 			f_.push_back(f);
 
@@ -90,8 +149,46 @@ namespace tmx::curve {
 		{
 			return { t_.back(), f_.back() };
 		}
+		// Keep the first n knots.
+		pwflat& truncate(size_t n)
+		{
+			ENSURE(n <= size());
+
+			t_.resize(n);
+			f_.resize(n);
+			I_.resize(n);
+
+			return *this;
+		}
 	};
 
+	// Owning piecewise flat curve equal to a composite of piecewise flat curves with breaks t.
+	// The rate on each segment is the forward at its midpoint.
+	template<class T = double, class F = double>
+	inline pwflat<T, F> flatten(const interface<T, F>& f, std::vector<T> t)
+	{
+		std::sort(t.begin(), t.end());
+		t.erase(std::unique(t.begin(), t.end()), t.end());
+		std::erase_if(t, [](T u) { return !(u > 0 && u < math::infinity<T>); });
+
+		std::vector<F> r(t.size());
+		T t_ = 0;
+		for (size_t i = 0; i < t.size(); ++i) {
+			r[i] = f.forward((t_ + t[i]) / 2);
+			t_ = t[i];
+		}
+
+		return pwflat<T, F>(t.size(), t.data(), r.data(), f.forward(t_ + 1));
+	}
+	template<class T = double, class F = double>
+	inline pwflat<T, F> flatten(const interface<T, F>& f)
+	{
+		std::vector<T> t;
+		ENSURE(f.breaks(t) || !"flatten: curve is not piecewise flat");
+
+		return flatten(f, std::move(t));
+	}
+
 #ifdef _DEBUG
 	inline int pwflat_test()
 	{
@@ -102,6 +199,88 @@ namespace tmx::curve {
 			c2 = c;
 			assert(!(c2 != c));
 		}
+		{
+			double t[] = { 1, 2, 3 };
+			double f[] = { .01, .02, .03 };
+			pwflat<> c(3, t, f);
+			pwflat<> c2;
+			for (int i = 0; i < 3; ++i) {
+				c2.push_back(t[i], f[i]);
+			}
+			assert(c == c2);
+			for (double u = 0; u <= 3; u += 0.25) {
+				double I = tmx::pwflat::integral(u, 3, t, f);
+				assert(c.integral(u) == I);
+				assert(c2.integral(u) == I);
+			}
+			c2.truncate(1).push_back(t[1], f[1]).push_back(t[2], f[2]);
+			assert(c == c2);
+			assert(c2.integral(2.5) == c.integral(2.5));
+		}
+		{
+			double t[] = { 1, 2, 3 };
+			double f[] = { .01, .02, .03 };
+			pwflat<> c(3, t, f);
+			const double u[] = { 0, 0.5, 1, 2.5, 3, 4 };
+			double v[6];
+			c.discount(u, v, 3., .04);
+			for (int i = 0; i < 6; ++i) {
+				assert(v[i] == c.discount(u[i], 3., .04));
+			}
+			c.spot(u, v, 3., .04);
+			for (int i = 0; i < 6; ++i) {
+				assert(v[i] == c.spot(u[i], 3., .04));
+			}
+			c.forward(u, v, 3., .04);
+			for (int i = 0; i < 6; ++i) {
+				assert(v[i] == c.forward(u[i], 3., .04));
+			}
+			auto cc = c.cursor();
+			for (int i = 0; i < 6; ++i) {
+				assert(cc.discount(u[i]) == c.discount(u[i]) || math::isnan(c.discount(u[i])));
+			}
+			const auto cs = c + .01;
+			cs.integral(u, v, 3., .04);
+			for (int i = 0; i < 6; ++i) {
+				assert(v[i] == cs.integral(u[i], 3., .04));
+			}
+			const auto ct = curve::translate(c, .5);
+			ct.integral(u, v, 2., .04);
+			for (int i = 0; i < 6; ++i) {
+				assert(v[i] == ct.integral(u[i], 2., .04));
+			}
+		}
+		{
+			double t[] = { 1, 2, 3 };
+			double f[] = { .01, .02, .03 };
+			pwflat<> c(3, t, f, .04);
+			assert(flatten(c) == c);
+			assert(flatten(curve::constant(.05)) == pwflat<>(.05));
+
+			const auto e = curve::extrapolate(c, 2.5, .05);
+			const auto b = curve::bump(.01, .5, 1.5);
+			const auto ct = curve::translate(e, .25);
+			const auto cb = ct + b;
+			const auto g = flatten(cb + .02);
+			assert(equal(g.time(), { .5, .75, 1.5, 1.75, 2.25 }));
+			for (double u = 0; u < 4; u += 0.125) {
+				assert(std::fabs(g.integral(u) - (cb + .02).integral(u)) <= 4 * math::epsilon<double>);
+			}
+		}
+		{
+			struct linear : public interface<> {
+				double _forward(double u) const override { return u; }
+				double _integral(double u) const override { return u * u / 2; }
+			};
+			bool thrown = false;
+			try {
+				flatten(linear{});
+			}
+			catch (const std::runtime_error&) {
+				thrown = true;
+			}
+			assert(thrown);
+		}
 
 		return 0;
 	}
@@ -21,8 +21,12 @@ Discount is represented using a piecewise flat right-continuous forward curve.
 	Note f(t[i]) = f[i].
 */
 #pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
 #include <cmath>
 #include <algorithm>
+#include <array>
 #include <limits>
 #include <numeric>
 #include <iterator>
@@ -134,6 +138,174 @@ namespace tmx::pwflat {
 	}
 #endif // _DEBUG
 
+	// Cumulative integrals I[i] = int_0^t[i] f(s) ds.
+	template<class T, class F>
+	constexpr void integrals(size_t n, const T* t, const F* f, F* I)
+	{
+		F I_ = 0;
+		T t_ = 0;
+
+		for (size_t i = 0; i < n; ++i) {
+			I_ += f[i] * (t[i] - t_);
+			I[i] = I_;
+			t_ = t[i];
+		}
+	}
+
+	// Integral from 0 to u of f given cumulative integrals I using binary search.
+	template<class T, class F>
+	constexpr F integral(T u, size_t n, const T* t, const F* f, const F* I, F _f = math::NaN<F>)
+	{
+		if (u < 0)  return math::NaN<F>;
+		if (u == 0) return 0;
+		if (n == 0) return u * _f;
+
+		size_t i = std::lower_bound(t, t + n, u) - t; // smallest i with u <= t[i]
+		if (i == 0) {
+			return f[0] * u;
+		}
+
+		return I[i - 1] + (i == n ? _f : f[i]) * (u - t[i - 1]);
+	}
+#ifdef _DEBUG
+	inline int integrals_test()
+	{
+		{
+			static constexpr double t[] = { 1,2,3 };
+			static constexpr double f[] = { 4,5,6 };
+			constexpr auto I = [] {
+				std::array<double, 3> I{};
+				integrals(3, t, f, I.data());
+				return I;
+				}();
+			static_assert(I[0] == 4 && I[1] == 4 + 5 && I[2] == 4 + 5 + 6);
+			static_assert(math::isnan(integral(-1., 3, t, f, I.data())));
+			static_assert(integral(0., 3, t, f, I.data()) == 0);
+			static_assert(integral(0.5, 3, t, f, I.data()) == 4 * 0.5);
+			static_assert(integral(1., 3, t, f, I.data()) == 4);
+			static_assert(integral(1.5, 3, t, f, I.data()) == 4 + 5 * 0.5);
+			static_assert(integral(2., 3, t, f, I.data()) == 4 + 5);
+			static_assert(integral(2.5, 3, t, f, I.data()) == 4 + 5 + 6 * 0.5);
+			static_assert(integral(3., 3, t, f, I.data()) == 4 + 5 + 6);
+			static_assert(math::isnan(integral(3.1, 3, t, f, I.data())));
+			static_assert(integral(3.5, 3, t, f, I.data(), 7.) == 4 + 5 + 6 + 7 * 0.5);
+			for (double u = 0; u < 4; u += 0.125) {
+				assert(integral(u, 3, t, f, I.data(), 7.) == integral(u, 3, t, f, 7.));
+			}
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
+	// Forward, integral, and discount at non-decreasing times u.
+	// Walks the knots and times together so m calls cost O(n + m).
+	// A time less than the previous time restarts from the first knot.
+	template<class T = double, class F = double>
+	class cursor {
+		size_t n;
+		const T* t;
+		const F* f;
+		F _f;
+		size_t i; // first knot with u <= t[i]
+		T t_;     // t[i - 1] or 0
+		F I_;     // int_0^t_ f(s) ds
+		T u_;     // last time
+	public:
+		constexpr cursor(size_t n, const T* t, const F* f, F _f = math::NaN<F>)
+			: n(n), t(t), f(f), _f(_f), i(0), t_(0), I_(0), u_(0)
+		{ }
+
+		// Move to time u.
+		constexpr cursor& seek(T u)
+		{
+			if (u < u_) {
+				i = 0;
+				t_ = 0;
+				I_ = 0;
+			}
+			while (i < n && t[i] < u) {
+				I_ += f[i] * (t[i] - t_);
+				t_ = t[i];
+				++i;
+			}
+			u_ = u;
+
+			return *this;
+		}
+		// Segment (t[i - 1], t[i]] containing the last time with i = n past the last knot.
+		constexpr size_t segment() const
+		{
+			return i;
+		}
+		// Start of segment, t[i - 1] or 0.
+		constexpr T start() const
+		{
+			return t_;
+		}
+		// End of segment, t[i] or infinity past the last knot.
+		constexpr T stop() const
+		{
+			return i < n ? t[i] : math::infinity<T>;
+		}
+
+		constexpr F forward(T u)
+		{
+			if (u < 0) return math::NaN<F>;
+
+			return seek(u).i == n ? _f : f[i];
+		}
+		constexpr F integral(T u)
+		{
+			if (u < 0)  return math::NaN<F>;
+			if (u == 0) return 0;
+
+			seek(u);
+
+			return I_ + (i == n ? _f : f[i]) * (u - t_);
+		}
+		constexpr F discount(T u)
+		{
+			using std::exp;
+
+			return exp(-integral(u));
+		}
+	};
+#ifdef _DEBUG
+	inline int cursor_test()
+	{
+		{
+			static constexpr double t[] = { 1,2,3 };
+			static constexpr double f[] = { 4,5,6 };
+			static_assert(cursor(3, t, f).integral(0.) == 0);
+			static_assert(cursor(3, t, f).integral(2.5) == 4 + 5 + 6 * 0.5);
+			static_assert(cursor(3, t, f).forward(2.) == 5);
+			static_assert(math::isnan(cursor(3, t, f).integral(3.1)));
+			static_assert(cursor(3, t, f, 7.).integral(3.5) == 4 + 5 + 6 + 7 * 0.5);
+			static_assert(cursor(3, t, f).seek(1.5).segment() == 1);
+			static_assert(cursor(3, t, f).seek(1.5).start() == 1);
+			static_assert(cursor(3, t, f).seek(1.5).stop() == 2);
+			static_assert(cursor(3, t, f).seek(3.5).stop() == math::infinity<double>);
+			static_assert(cursor(3, t, f).seek(2.).segment() == 1);
+			static_assert(cursor(3, t, f).seek(3.5).segment() == 3);
+		}
+		{
+			static constexpr double t[] = { 1,2,3 };
+			static constexpr double f[] = { 4,5,6 };
+			cursor c(3, t, f, 7.);
+			for (double u = 0; u < 4; u += 0.125) {
+				assert(c.integral(u) == integral(u, 3, t, f, 7.));
+				assert(c.forward(u) == forward(u, 3, t, f, 7.));
+			}
+			// restart
+			assert(c.integral(1.5) == integral(1.5, 3, t, f, 7.));
+			assert(c.integral(0.5) == integral(0.5, 3, t, f, 7.));
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
 	// discount D(u) = exponential(-int_0^u f(t) dt)
 	template<class T, class F>
 	constexpr F discount(T u, size_t n, const T* t, const F* f, F _f = math::NaN<F>)
@@ -0,0 +1,81 @@
+// tmx_instrument_columns.h - Cash flows of many instruments stored in columns.
+// Instrument j has cash flows (u[k], c[k]) for offset[j] <= k < offset[j + 1].
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <cstddef>
+#include <span>
+#include "ensure.h"
+
+namespace tmx::instrument {
+
+	// Non-owning view of cash flow columns.
+	template<class U = double, class C = double>
+	struct columns {
+		using time_type = U;
+		using cash_type = C;
+
+		std::span<const size_t> offset; // size() + 1 entries starting at 0
+		std::span<const U> u;
+		std::span<const C> c;
+
+		constexpr columns() = default;
+		constexpr columns(std::span<const size_t> offset, std::span<const U> u, std::span<const C> c)
+			: offset(offset), u(u), c(c)
+		{
+			ENSURE(u.size() == c.size());
+			ENSURE(offset.size() > 0 && offset.front() == 0 && offset.back() == u.size());
+		}
+
+		// Number of instruments.
+		constexpr size_t size() const
+		{
+			return offset.size() ? offset.size() - 1 : 0;
+		}
+		// Number of cash flows of instrument j.
+		constexpr size_t size(size_t j) const
+		{
+			return offset[j + 1] - offset[j];
+		}
+		constexpr std::span<const U> time(size_t j) const
+		{
+			return u.subspan(offset[j], size(j));
+		}
+		constexpr std::span<const C> cash(size_t j) const
+		{
+			return c.subspan(offset[j], size(j));
+		}
+	};
+
+#ifdef _DEBUG
+	inline int columns_test()
+	{
+		{
+			const size_t o[] = { 0, 1, 3 };
+			const double u[] = { 1, 0.5, 1 };
+			const double c[] = { 1, 0.02, 1.02 };
+			const columns<> cf{ std::span<const size_t>(o), std::span<const double>(u), std::span<const double>(c) };
+			assert(cf.size() == 2);
+			assert(cf.size(0) == 1);
+			assert(cf.size(1) == 2);
+			assert(cf.time(1)[0] == 0.5);
+			assert(cf.cash(1)[1] == 1.02);
+		}
+		{
+			const size_t o[] = { 0, 2 };
+			const double u[] = { 1 };
+			const double c[] = { 1 };
+			try {
+				columns<> cf{ std::span<const size_t>(o), std::span<const double>(u), std::span<const double>(c) };
+				assert(false);
+			}
+			catch (const std::runtime_error&) {
+			}
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
+} // namespace tmx::instrument
@@ -0,0 +1,59 @@
+// tmx_instrument_fixed.h - Instruments with a number of cash flows known at compile time.
+// Benchmark tenors have fixed shapes so valuation loops can be unrolled
+// and no storage is allocated.
+#pragma once
+#include <array>
+#include <cstddef>
+#include "instrument/tmx_instrument.h"
+
+namespace tmx::instrument {
+
+	// N cash flows (u[i], c[i]) at non-decreasing times.
+	template<size_t N, class U = double, class C = double>
+	struct fixed {
+		using time_type = U;
+		using cash_type = C;
+
+		std::array<U, N> u;
+		std::array<C, N> c;
+
+		static constexpr size_t size()
+		{
+			return N;
+		}
+		constexpr cash_flow<U, C> operator[](size_t i) const
+		{
+			return cash_flow<U, C>(u[i], c[i]);
+		}
+		// Iterable over the arrays.
+		constexpr auto view() const
+		{
+			return iterable(fms::iterable::interval(u.data(), u.data() + N), fms::iterable::interval(c.data(), c.data() + N));
+		}
+	};
+
+	// Same cash flows as simple(Years, coupon, Freq): coupons followed by unit notional at maturity.
+	template<unsigned Years, unsigned Freq = 2, class U = double, class C = double>
+	constexpr auto fixed_simple(C coupon)
+	{
+		constexpr size_t n = Years * Freq;
+		fixed<n + 1, U, C> i{};
+		for (size_t k = 0; k < n; ++k) {
+			i.u[k] = U(k + 1) / Freq;
+			i.c[k] = coupon / Freq;
+		}
+		i.u[n] = U(Years);
+		i.c[n] = C(1);
+
+		return i;
+	}
+#ifdef _DEBUG
+	static_assert(fixed_simple<1>(.05).size() == 3);
+	static_assert(fixed_simple<1>(.05)[0] == cash_flow(.5, .025));
+	static_assert(fixed_simple<1>(.05)[1] == cash_flow(1., .025));
+	static_assert(fixed_simple<1>(.05)[2] == cash_flow(1., 1.));
+	static_assert(fixed_simple<30, 12>(.06).size() == 361);
+	static_assert(equal(fixed_simple<2, 4>(.04).view(), simple(2., .04, 4)));
+#endif // _DEBUG
+
+} // namespace tmx::instrument
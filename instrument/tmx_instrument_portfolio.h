@@ -0,0 +1,312 @@
+// tmx_instrument_portfolio.h - Owning storage for the cash flows of many instruments.
+// Every cash flow is in one pair of arrays with an offset per instrument
+// so valuation streams through memory instead of following iterables.
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ensure.h"
+#include "instrument/tmx_instrument.h"
+#include "instrument/tmx_instrument_columns.h"
+#include "instrument/tmx_instrument_table.h"
+
+namespace tmx::instrument {
+
+	// Call work(k) for k < threads, each on its own thread, and rethrow the first exception.
+	template<class W>
+	inline void parallel_blocks(unsigned threads, const W& work)
+	{
+		std::vector<std::exception_ptr> e(threads);
+		const auto work_ = [&work, &e](unsigned k) {
+			try {
+				work(k);
+			}
+			catch (...) {
+				e[k] = std::current_exception();
+			}
+		};
+		{
+			std::vector<std::jthread> pool;
+			for (unsigned k = 1; k < threads; ++k) {
+				pool.emplace_back(work_, k);
+			}
+			work_(0);
+		}
+		for (const auto& ek : e) {
+			if (ek) {
+				std::rethrow_exception(ek);
+			}
+		}
+	}
+
+	// Instrument j has cash flows (u[k], c[k]) for offset[j] <= k < offset[j + 1].
+	template<class U = double, class C = double>
+	class portfolio {
+		std::vector<size_t> offset_{ 0 };
+		std::vector<U> u_;
+		std::vector<C> c_;
+	public:
+		using time_type = U;
+		using cash_type = C;
+
+		portfolio() = default;
+		// Cash flows of instruments i(j) for j < n. Each thread counts the cash flows of a
+		// contiguous block of instruments and, once the arrays are sized, writes them in place.
+		template<class I>
+		portfolio(size_t n, const I& i, unsigned threads = std::thread::hardware_concurrency())
+			: offset_(n + 1, 0)
+		{
+			threads = std::clamp<unsigned>(threads, 1, static_cast<unsigned>(std::max<size_t>(n, 1)));
+			const size_t m = (n + threads - 1) / threads; // instruments per block
+
+			parallel_blocks(threads, [&](unsigned k) {
+				for (size_t j = k * m; j < std::min(n, (k + 1) * m); ++j) {
+					size_t n_ = 0;
+					for (auto i_ = i(j); i_; ++i_) {
+						++n_;
+					}
+					offset_[j + 1] = n_;
+				}
+			});
+			for (size_t j = 0; j < n; ++j) {
+				offset_[j + 1] += offset_[j];
+			}
+			u_.resize(offset_[n]);
+			c_.resize(offset_[n]);
+
+			parallel_blocks(threads, [&](unsigned k) {
+				for (size_t j = k * m; j < std::min(n, (k + 1) * m); ++j) {
+					size_t o = offset_[j];
+					for (auto i_ = i(j); i_; ++i_, ++o) {
+						ENSURE(o < offset_[j + 1] || !"portfolio: instrument changed size");
+						const auto uc = *i_;
+						u_[o] = uc.u;
+						c_[o] = uc.c;
+					}
+					ENSURE(o == offset_[j + 1] || !"portfolio: instrument changed size");
+				}
+			});
+		}
+
+		// Number of instruments.
+		size_t size() const
+		{
+			return offset_.size() - 1;
+		}
+		// Append the cash flows of an instrument.
+		template<class I>
+		portfolio& push_back(I i)
+		{
+			while (i) {
+				const auto uc = *i;
+				u_.push_back(uc.u);
+				c_.push_back(uc.c);
+				++i;
+			}
+			offset_.push_back(u_.size());
+
+			return *this;
+		}
+		// View used by value functions.
+		instrument::columns<U, C> columns() const
+		{
+			return instrument::columns<U, C>{ std::span<const size_t>(offset_), std::span<const U>(u_), std::span<const C>(c_) };
+		}
+	};
+
+	// One instrument holding quantity q[j] of instrument j with a cash flow at each distinct time.
+	// Each thread sums a block of instruments by time and the blocks are then combined.
+	template<class U, class C>
+	inline table<U, C> net(const columns<U, C>& cf, std::span<const C> q,
+		unsigned threads = std::thread::hardware_concurrency())
+	{
+		ENSURE(q.size() == cf.size());
+
+		const size_t n = cf.size();
+		threads = std::clamp<unsigned>(threads, 1, static_cast<unsigned>(std::max<size_t>(n, 1)));
+		const size_t m = (n + threads - 1) / threads;
+
+		std::vector<std::unordered_map<U, C>> block(threads);
+		parallel_blocks(threads, [&](unsigned k) {
+			auto& b = block[k];
+			for (size_t j = k * m; j < std::min(n, (k + 1) * m); ++j) {
+				for (size_t i = cf.offset[j]; i < cf.offset[j + 1]; ++i) {
+					b[cf.u[i]] += q[j] * cf.c[i];
+				}
+			}
+		});
+		for (unsigned k = 1; k < threads; ++k) {
+			for (const auto& [u, c] : block[k]) {
+				block[0][u] += c;
+			}
+		}
+
+		std::vector<cash_flow<U, C>> uc;
+		uc.reserve(block[0].size());
+		for (const auto& [u, c] : block[0]) {
+			uc.emplace_back(u, c);
+		}
+		std::sort(uc.begin(), uc.end());
+		std::vector<U> u(uc.size());
+		std::vector<C> c(uc.size());
+		for (size_t i = 0; i < uc.size(); ++i) {
+			u[i] = uc[i].u;
+			c[i] = uc[i].c;
+		}
+
+		return table(iterable(fms::iterable::make_interval(u), fms::iterable::make_interval(c)));
+	}
+
+	// One instrument holding quantity q[j] of instrument j with cash flows at increasing grid times t.
+	// A cash flow at t[i] <= u <= t[i + 1] is split between t[i] and t[i + 1] so the
+	// total amount and its first moment in time are preserved. Cash flows outside the grid go to the nearest end.
+	template<class U, class C>
+	inline table<U, C> net(const columns<U, C>& cf, std::span<const C> q, std::span<const U> t,
+		unsigned threads = std::thread::hardware_concurrency())
+	{
+		ENSURE(q.size() == cf.size());
+		ENSURE(t.size() > 0 && std::is_sorted(t.begin(), t.end()));
+
+		const size_t n = cf.size();
+		threads = std::clamp<unsigned>(threads, 1, static_cast<unsigned>(std::max<size_t>(n, 1)));
+		const size_t m = (n + threads - 1) / threads;
+
+		std::vector<std::vector<C>> block(threads, std::vector<C>(t.size(), C(0)));
+		parallel_blocks(threads, [&](unsigned k) {
+			auto& b = block[k];
+			for (size_t j = k * m; j < std::min(n, (k + 1) * m); ++j) {
+				for (size_t i = cf.offset[j]; i < cf.offset[j + 1]; ++i) {
+					const U u = cf.u[i];
+					const C c = q[j] * cf.c[i];
+					const size_t r = std::upper_bound(t.begin(), t.end(), u) - t.begin(); // t[r - 1] <= u < t[r]
+					if (r == 0) {
+						b[0] += c;
+					}
+					else if (r == t.size()) {
+						b[r - 1] += c;
+					}
+					else {
+						const C w = (u - t[r - 1]) / (t[r] - t[r - 1]);
+						b[r - 1] += (1 - w) * c;
+						b[r] += w * c;
+					}
+				}
+			}
+		});
+		for (unsigned k = 1; k < threads; ++k) {
+			for (size_t i = 0; i < t.size(); ++i) {
+				block[0][i] += block[k][i];
+			}
+		}
+
+		return table(iterable(fms::iterable::make_interval(std::vector<U>(t.begin(), t.end())), fms::iterable::make_interval(block[0])));
+	}
+
+#ifdef _DEBUG
+	inline int portfolio_test()
+	{
+		// instrument j has j % 5 cash flows of j at times 1, 2, ...
+		const auto i = [](size_t j) {
+			using namespace fms::iterable;
+
+			return take(iterable(sequence(1., 1.), constant(double(j))), j % 5);
+		};
+		{
+			const size_t n = 37;
+			const portfolio<> p1(n, i, 1);
+			const portfolio<> p4(n, i, 4);
+			assert(p1.size() == n && p4.size() == n);
+			const auto cf = p4.columns();
+			for (size_t j = 0; j < n; ++j) {
+				assert(cf.size(j) == j % 5);
+				for (size_t k = 0; k < cf.size(j); ++k) {
+					assert(cf.time(j)[k] == k + 1);
+					assert(cf.cash(j)[k] == j);
+				}
+			}
+			assert(std::equal(cf.offset.begin(), cf.offset.end(), p1.columns().offset.begin()));
+			assert(std::equal(cf.u.begin(), cf.u.end(), p1.columns().u.begin()));
+			assert(std::equal(cf.c.begin(), cf.c.end(), p1.columns().c.begin()));
+
+			// same as appending in order
+			portfolio<> p;
+			for (size_t j = 0; j < n; ++j) {
+				p.push_back(i(j));
+			}
+			assert(std::equal(cf.offset.begin(), cf.offset.end(), p.columns().offset.begin(), p.columns().offset.end()));
+			assert(std::equal(cf.u.begin(), cf.u.end(), p.columns().u.begin(), p.columns().u.end()));
+			assert(std::equal(cf.c.begin(), cf.c.end(), p.columns().c.begin(), p.columns().c.end()));
+		}
+		{
+			const portfolio<> p(0, i, 4);
+			assert(p.size() == 0);
+			assert(p.columns().size() == 0);
+		}
+		{
+			portfolio<> p;
+			p.push_back(zero_coupon_bond(2.)).push_back(i(3));
+			assert(p.size() == 2);
+			assert(p.columns().size(1) == 3);
+		}
+		{
+			const auto throws = [&i](size_t j) {
+				if (j == 20) {
+					throw std::runtime_error("bad instrument");
+				}
+
+				return i(j);
+			};
+			try {
+				portfolio<> p(37, throws, 4);
+				assert(false);
+			}
+			catch (const std::runtime_error&) {
+			}
+		}
+
+		{
+			// net 1 of each instrument
+			const size_t n = 37;
+			const portfolio<> p(n, i, 4);
+			const std::vector<double> q(n, 1.);
+			const auto t = net(p.columns(), std::span<const double>(q), 3);
+			assert(t.size() == 4);
+			for (size_t k = 0; k < 4; ++k) {
+				assert(t.time()[k] == k + 1);
+			}
+			double c0 = 0;
+			for (size_t j = 0; j < n; ++j) {
+				c0 += j % 5 > 0 ? j : 0;
+			}
+			assert(t.cash()[0] == c0);
+
+			// on a grid
+			const double g[] = { 0, 2.5, 3 };
+			const auto tg = net(p.columns(), std::span<const double>(q), std::span<const double>(g), 2);
+			assert(tg.size() == 3);
+			double c = 0, uc = 0, c_ = 0, uc_ = 0;
+			for (size_t k = 0; k < 4; ++k) {
+				c += t.cash()[k];
+				uc += t.time()[k] * t.cash()[k];
+			}
+			for (size_t k = 0; k < 3; ++k) {
+				c_ += tg.cash()[k];
+				uc_ += tg.time()[k] * tg.cash()[k];
+			}
+			assert(std::fabs(c - c_) <= 1e-12);
+			// time 4 is past the end of the grid
+			assert(std::fabs(uc - uc_ - t.cash()[3]) <= 1e-12);
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
+} // namespace tmx::instrument
@@ -0,0 +1,171 @@
+// tmx_instrument_regular.h - Instruments with equally spaced equal coupons.
+// Present value at a constant yield is then a geometric series.
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include "instrument/tmx_instrument.h"
+
+namespace tmx::instrument {
+
+	// n coupons c at u, u + du, ..., u + (n - 1) du with principal p paid with the last coupon
+	// and an optional stub cash flow cs at us < u.
+	template<class U = double, class C = double>
+	struct regular {
+		U u, du;
+		size_t n;
+		C c, p;
+		U us = 0;
+		C cs = 0;
+
+		constexpr U maturity() const
+		{
+			return u + (n - 1) * du;
+		}
+	};
+
+	// Regular schedule of the payments (t, a) added in order.
+	template<class U, class C>
+	class regular_fit {
+		regular<U, C> r_{ 0, 0, 0, 0, 0 };
+		U t_ = 0; // last time
+		C a_ = 0; // last amount
+		bool ok_ = true;
+	public:
+		// False once the payments can no longer be regular.
+		explicit operator bool() const
+		{
+			return ok_;
+		}
+		// Spacing must agree to tol relative to the time.
+		regular_fit& add(U t, C a, U tol)
+		{
+			if (r_.n == 0) {
+				r_.u = t;
+				r_.c = a;
+			}
+			else if (r_.n == 1) {
+				r_.du = t - r_.u;
+			}
+			else if (std::fabs((t - t_) - r_.du) > tol * (1 + std::fabs(t)) || a_ != r_.c) { // only the last amount includes principal
+				ok_ = false;
+			}
+			t_ = t;
+			a_ = a;
+			++r_.n;
+
+			return *this;
+		}
+		std::optional<regular<U, C>> value() const
+		{
+			if (!ok_ || r_.n == 0) {
+				return std::nullopt;
+			}
+			regular<U, C> r = r_;
+			r.p = a_ - r.c;
+
+			return r;
+		}
+	};
+
+	// Regular schedule of i possibly after a stub cash flow.
+	// Cash flows at the same time are combined. One pass that stops at the first mismatch.
+	template<class IU, class IC, class U = std::iter_value_t<IU>, class C = std::iter_value_t<IC>>
+	inline std::optional<regular<U, C>> make_regular(iterable<IU, IC> i, U tol = U(1e-10))
+	{
+		regular_fit<U, C> r, rs; // starting at the first payment or after it
+		U us = 0;
+		C cs = 0;
+		for (size_t k = 0; i && (r || rs); ++k) {
+			// next payment time t and total amount a
+			const U t = (*i).u;
+			C a = 0;
+			while (i && (*i).u == t) {
+				a += (*i).c;
+				++i;
+			}
+			if (r) {
+				r.add(t, a, tol);
+			}
+			if (k == 0) {
+				us = t;
+				cs = a;
+			}
+			else if (rs) {
+				rs.add(t, a, tol);
+			}
+		}
+
+		if (auto r_ = r.value()) {
+			return r_;
+		}
+		if (auto r_ = rs.value()) {
+			r_->us = us;
+			r_->cs = cs;
+
+			return r_;
+		}
+
+		return std::nullopt;
+	}
+
+#ifdef _DEBUG
+	inline int regular_test()
+	{
+		using fms::iterable::array;
+		{
+			// simple bond with principal as a separate cash flow
+			double u[] = { .5, 1, 1.5, 2, 2 };
+			double c[] = { .02, .02, .02, .02, 1 };
+			const auto r = make_regular(iterable(array(u), array(c)));
+			assert(r);
+			assert(r->u == .5 && r->du == .5 && r->n == 4);
+			assert(r->c == .02 && r->p == 1);
+			assert(r->cs == 0);
+			assert(r->maturity() == 2);
+		}
+		{
+			// short first coupon
+			double u[] = { .25, .75, 1.25, 1.75 };
+			double c[] = { .01, .02, .02, 1.02 };
+			const auto r = make_regular(iterable(array(u), array(c)));
+			assert(r);
+			assert(r->u == .75 && r->du == .5 && r->n == 3);
+			assert(r->c == .02 && r->p == 1);
+			assert(r->us == .25 && r->cs == .01);
+		}
+		{
+			// small first coupon at the regular spacing
+			double u[] = { .5, 1, 1.5, 2 };
+			double c[] = { .01, .02, .02, 1.02 };
+			const auto r = make_regular(iterable(array(u), array(c)));
+			assert(r);
+			assert(r->u == 1 && r->du == .5 && r->n == 3);
+			assert(r->us == .5 && r->cs == .01);
+		}
+		{
+			// zero coupon bond
+			double u[] = { 3 };
+			double c[] = { 1 };
+			const auto r = make_regular(iterable(array(u), array(c)));
+			assert(r && r->n == 1 && r->c == 1 && r->p == 0);
+		}
+		{
+			// irregular
+			double u[] = { .5, 1, 2, 2.5 };
+			double c[] = { .02, .02, .02, 1.02 };
+			assert(!make_regular(iterable(array(u), array(c))));
+			double u_[] = { .5, 1, 1.5, 2 };
+			double c_[] = { .02, .03, .02, 1.02 };
+			assert(!make_regular(iterable(array(u_), array(c_))));
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
+} // namespace tmx::instrument
@@ -0,0 +1,95 @@
+// tmx_instrument_table.h - Cash flows of an instrument materialized in contiguous arrays.
+// Running the iterable pipeline once lets repeated valuations loop over plain arrays.
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <iterator>
+#include <optional>
+#include <span>
+#include <vector>
+#include "instrument/tmx_instrument.h"
+#include "instrument/tmx_instrument_regular.h"
+
+namespace tmx::instrument {
+
+	// Times and amounts of cash flows in separate arrays with the regular schedule, if any.
+	template<class U = double, class C = double>
+	class table {
+		std::vector<U> u_;
+		std::vector<C> c_;
+		std::optional<instrument::regular<U, C>> r_;
+	public:
+		using time_type = U;
+		using cash_type = C;
+
+		table() = default;
+		// Any iterable of cash flows, e.g., instrument::iterable or a concatenation of them.
+		template<class I>
+		explicit table(I i)
+		{
+			while (i) {
+				const auto uc = *i;
+				u_.push_back(uc.u);
+				c_.push_back(uc.c);
+				++i;
+			}
+			r_ = make_regular(view());
+		}
+
+		size_t size() const
+		{
+			return u_.size();
+		}
+		std::span<const U> time() const
+		{
+			return u_;
+		}
+		std::span<const C> cash() const
+		{
+			return c_;
+		}
+		// Regular schedule detected when the table was built.
+		const std::optional<instrument::regular<U, C>>& regular() const
+		{
+			return r_;
+		}
+		// Iterable over the arrays.
+		auto view() const
+		{
+			return iterable(fms::iterable::make_interval(u_), fms::iterable::make_interval(c_));
+		}
+	};
+	template<class I>
+	table(I) -> table<typename std::iter_value_t<I>::time_type, typename std::iter_value_t<I>::cash_type>;
+
+#ifdef _DEBUG
+	inline int table_test()
+	{
+		{
+			const auto t = table(simple(2., .04));
+			assert(t.size() == 5);
+			assert(t.time()[0] == .5 && t.time()[4] == 2);
+			assert(t.cash()[0] == .02 && t.cash()[4] == 1);
+			assert(equal(t.view(), simple(2., .04)));
+			assert(t.regular());
+			assert(t.regular()->n == 4 && t.regular()->c == .02 && t.regular()->p == 1);
+		}
+		{
+			const double u[] = { .5, 1, 2, 2.5 };
+			const double c[] = { .02, .02, .02, 1.02 };
+			const auto t = table(iterable(fms::iterable::array(u), fms::iterable::array(c)));
+			assert(t.size() == 4);
+			assert(!t.regular());
+		}
+		{
+			const table<> t;
+			assert(t.size() == 0);
+			assert(!t.view());
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
+} // namespace tmx::instrument
@@ -0,0 +1,285 @@
+// tmx_instrument_view.h - Instruments over cash flows owned elsewhere.
+// Nothing is copied, so the times and amounts can live in caller buffers
+// or in a memory mapped file written by columns_write.
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#endif // _DEBUG
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+#include "ensure.h"
+#include "instrument/tmx_instrument.h"
+#include "instrument/tmx_instrument_columns.h"
+
+namespace tmx::instrument {
+
+	// Instrument with cash flows (u[i], c[i]) that does not own them.
+	template<class U, class C>
+	inline auto view(std::span<const U> u, std::span<const C> c)
+	{
+		ENSURE(u.size() == c.size());
+
+		return iterable(fms::iterable::interval(u.data(), u.data() + u.size()),
+			fms::iterable::interval(c.data(), c.data() + c.size()));
+	}
+
+	// Binary layout of columns in native byte order. Sections start on 8 byte boundaries.
+	// header | offset[n + 1] as uint64_t | u[m] | c[m]
+	struct columns_header {
+		static constexpr char tag[8] = { 't', 'm', 'x', 'c', 'o', 'l', 's', '\0' };
+		static constexpr uint32_t current = 1;
+
+		char magic[8];
+		uint32_t version;
+		uint16_t time_size; // sizeof(U)
+		uint16_t cash_size; // sizeof(C)
+		uint64_t n; // instruments
+		uint64_t m; // cash flows
+	};
+	static_assert(sizeof(columns_header) == 32);
+
+	// Size rounded up to the next section boundary.
+	constexpr size_t columns_align(size_t size)
+	{
+		return (size + 7) & ~size_t(7);
+	}
+
+	// Write cf using the binary layout.
+	template<class U, class C>
+	inline std::ostream& columns_write(std::ostream& os, const columns<U, C>& cf)
+	{
+		columns_header h{};
+		std::memcpy(h.magic, columns_header::tag, sizeof(h.magic));
+		h.version = columns_header::current;
+		h.time_size = sizeof(U);
+		h.cash_size = sizeof(C);
+		h.n = cf.size();
+		h.m = cf.u.size();
+
+		const char pad[8] = {};
+		const auto section = [&os, &pad](const void* p, size_t size) {
+			os.write(static_cast<const char*>(p), size);
+			os.write(pad, columns_align(size) - size);
+		};
+		section(&h, sizeof(h));
+		for (size_t j = 0; j <= h.n; ++j) {
+			const uint64_t o = cf.offset.empty() ? 0 : cf.offset[j];
+			os.write(reinterpret_cast<const char*>(&o), sizeof(o));
+		}
+		section(cf.u.data(), cf.u.size_bytes());
+		section(cf.c.data(), cf.c.size_bytes());
+
+		return os;
+	}
+
+	// Columns over bytes in the binary layout without copying.
+	// The buffer must be 8 byte aligned and outlive the result.
+	template<class U = double, class C = double>
+	inline columns<U, C> columns_view(std::span<const std::byte> b)
+	{
+		static_assert(sizeof(size_t) == sizeof(uint64_t));
+
+		ENSURE(reinterpret_cast<uintptr_t>(b.data()) % 8 == 0);
+		ENSURE(b.size() >= sizeof(columns_header));
+		const auto& h = *reinterpret_cast<const columns_header*>(b.data());
+		ENSURE(std::memcmp(h.magic, columns_header::tag, sizeof(h.magic)) == 0);
+		ENSURE(h.version == columns_header::current);
+		ENSURE(h.time_size == sizeof(U) && h.cash_size == sizeof(C));
+		ENSURE(h.n < b.size() && h.m < b.size());
+
+		const size_t o = sizeof(columns_header);
+		const size_t ou = o + (h.n + 1) * sizeof(uint64_t);
+		const size_t oc = ou + columns_align(h.m * sizeof(U));
+		ENSURE(b.size() >= oc + columns_align(h.m * sizeof(C)));
+
+		// instrument j has cash flows offset[j] to offset[j + 1] within u and c
+		const std::span<const size_t> offset(reinterpret_cast<const size_t*>(b.data() + o), h.n + 1);
+		ENSURE(offset.front() == 0 && offset.back() == h.m);
+		ENSURE(std::is_sorted(offset.begin(), offset.end()));
+
+		return columns<U, C>(
+			offset,
+			std::span<const U>(reinterpret_cast<const U*>(b.data() + ou), h.m),
+			std::span<const C>(reinterpret_cast<const C*>(b.data() + oc), h.m));
+	}
+
+	// Read only memory map of a file.
+	class mapped_file {
+		const std::byte* data_ = nullptr;
+		size_t size_ = 0;
+#ifdef _WIN32
+		HANDLE file_ = INVALID_HANDLE_VALUE;
+		HANDLE map_ = nullptr;
+#endif // _WIN32
+	public:
+		explicit mapped_file(const std::string& path)
+		{
+#ifdef _WIN32
+			file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			ENSURE(file_ != INVALID_HANDLE_VALUE);
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file_, &size)) {
+				CloseHandle(file_);
+				ENSURE(!"GetFileSizeEx failed");
+			}
+			size_ = static_cast<size_t>(size.QuadPart);
+			if (size_) {
+				map_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				data_ = map_ ? static_cast<const std::byte*>(MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+				if (!data_) {
+					if (map_) {
+						CloseHandle(map_);
+					}
+					CloseHandle(file_);
+					ENSURE(!"MapViewOfFile failed");
+				}
+			}
+#else
+			const int fd = ::open(path.c_str(), O_RDONLY);
+			ENSURE(fd != -1);
+			struct stat st;
+			if (::fstat(fd, &st) == -1) {
+				::close(fd);
+				ENSURE(!"fstat failed");
+			}
+			size_ = static_cast<size_t>(st.st_size);
+			if (size_) {
+				void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+				::close(fd);
+				ENSURE(p != MAP_FAILED);
+				data_ = static_cast<const std::byte*>(p);
+			}
+			else {
+				::close(fd);
+			}
+#endif // _WIN32
+		}
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+		~mapped_file()
+		{
+#ifdef _WIN32
+			if (data_) {
+				UnmapViewOfFile(data_);
+			}
+			if (map_) {
+				CloseHandle(map_);
+			}
+			if (file_ != INVALID_HANDLE_VALUE) {
+				CloseHandle(file_);
+			}
+#else
+			if (data_) {
+				::munmap(const_cast<std::byte*>(data_), size_);
+			}
+#endif // _WIN32
+		}
+
+		std::span<const std::byte> bytes() const
+		{
+			return { data_, size_ };
+		}
+	};
+
+#ifdef _DEBUG
+	inline int view_test()
+	{
+		const size_t o[] = { 0, 1, 3 };
+		const double u[] = { 1, 0.5, 1 };
+		const double c[] = { 1, 0.02, 1.02 };
+		const columns<> cf{ std::span<const size_t>(o), std::span<const double>(u), std::span<const double>(c) };
+		{
+			auto i = view(cf.time(1), cf.cash(1));
+			assert(*i == cash_flow(0.5, 0.02));
+			++i;
+			assert(*i == cash_flow(1., 1.02));
+			++i;
+			assert(!i);
+		}
+		{
+			std::ostringstream os;
+			columns_write(os, cf);
+			const std::string s = os.str();
+			std::vector<uint64_t> b((s.size() + 7) / 8);
+			std::memcpy(b.data(), s.data(), s.size());
+			const auto cf_ = columns_view(std::as_bytes(std::span(b)));
+			assert(cf_.size() == 2);
+			assert(cf_.size(1) == 2);
+			assert(cf_.time(1)[0] == 0.5 && cf_.cash(1)[1] == 1.02);
+
+			// truncated
+			try {
+				columns_view(std::as_bytes(std::span(b)).first(s.size() - 8));
+				assert(false);
+			}
+			catch (const std::runtime_error&) {
+			}
+			// wrong cash type
+			try {
+				columns_view<double, float>(std::as_bytes(std::span(b)));
+				assert(false);
+			}
+			catch (const std::runtime_error&) {
+			}
+			// offsets out of order
+			{
+				auto b_ = b;
+				const size_t o1 = sizeof(columns_header) / 8 + 1; // offset[1]
+				b_[o1] = 4;
+				try {
+					columns_view(std::as_bytes(std::span(b_)));
+					assert(false);
+				}
+				catch (const std::runtime_error&) {
+				}
+				// last offset not the number of cash flows
+				b_ = b;
+				b_[o1 + 1] = 2;
+				try {
+					columns_view(std::as_bytes(std::span(b_)));
+					assert(false);
+				}
+				catch (const std::runtime_error&) {
+				}
+			}
+		}
+		{
+			const auto path = std::filesystem::temp_directory_path() / "tmx_instrument_view_test.bin";
+			{
+				std::ofstream ofs(path, std::ios::binary);
+				columns_write(ofs, cf);
+			}
+			{
+				const mapped_file f(path.string());
+				const auto cf_ = columns_view(f.bytes());
+				assert(cf_.size() == 2);
+				assert(cf_.time(0)[0] == 1 && cf_.cash(1)[0] == 0.02);
+			}
+			std::filesystem::remove(path);
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
+} // namespace tmx::instrument
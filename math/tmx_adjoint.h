@@ -0,0 +1,476 @@
+// tmx_adjoint.h - Reverse mode automatic differentiation.
+// Operations on adjoint<X> record local partial derivatives on the active tape.
+// One backward sweep from an output gives its derivative with respect to every recorded node,
+// so the cost of a gradient is a small multiple of the cost of the evaluation.
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <algorithm>
+#include <cmath>
+#include <compare>
+#include <cstddef>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+#include "ensure.h"
+#include "math/tmx_math.h"
+
+namespace tmx::math {
+
+	template<class X>
+	class tape;
+
+	// Value and index of its node on the active tape. Constants have no node.
+	template<class X = double>
+	struct adjoint {
+		using value_type = X;
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		X x;
+		size_t i;
+
+		constexpr adjoint(X x = 0)
+			: x(x), i(npos)
+		{ }
+		constexpr adjoint(X x, size_t i)
+			: x(x), i(i)
+		{ }
+
+		// Independent variable on the active tape.
+		static adjoint variable(X x)
+		{
+			ENSURE(tape<X>::active() || !"adjoint: no active tape");
+
+			return tape<X>::active()->variable(x);
+		}
+
+		constexpr X value() const
+		{
+			return x;
+		}
+		constexpr bool is_constant() const
+		{
+			return i == npos;
+		}
+
+		// Compare values.
+		constexpr bool operator==(const adjoint& y) const noexcept
+		{
+			return x == y.x;
+		}
+		constexpr auto operator<=>(const adjoint& y) const noexcept
+		{
+			return x <=> y.x;
+		}
+
+		adjoint& operator+=(const adjoint& y);
+		adjoint& operator-=(const adjoint& y);
+		adjoint& operator*=(const adjoint& y);
+		adjoint& operator/=(const adjoint& y);
+		adjoint operator-() const;
+	};
+
+	template<class X>
+	struct is_adjoint : std::false_type {};
+	template<class X>
+	struct is_adjoint<adjoint<X>> : std::true_type {};
+	template<class X>
+	constexpr bool is_adjoint_v = is_adjoint<X>::value;
+
+	// Nodes in contiguous arrays with partial derivatives on edges to their parents.
+	// Constructing a tape makes it active on this thread until it is destroyed.
+	template<class X = double>
+	class tape {
+		std::vector<size_t> edge_;  // edges of node k are [edge_[k], edge_[k + 1])
+		std::vector<size_t> from_;  // parent node of each edge
+		std::vector<X> partial_;    // partial derivative with respect to parent
+		std::vector<X> adjoint_;    // adjoints from the last gradient
+		std::vector<X> scratch_;    // adjoints used by collapse
+		tape* prev_;
+
+		static inline thread_local tape* active_ = nullptr;
+
+		adjoint<X> push(X x)
+		{
+			edge_.push_back(from_.size());
+
+			return adjoint<X>(x, size() - 1);
+		}
+		void edge(const adjoint<X>& a, X da)
+		{
+			if (!a.is_constant()) {
+				from_.push_back(a.i);
+				partial_.push_back(da);
+			}
+		}
+		// Propagate adjoint of node k in adj to its parents.
+		void sweep(size_t k, std::vector<X>& adj) const
+		{
+			const X a = adj[k];
+			if (a != 0) {
+				for (size_t e = edge_[k]; e < edge_[k + 1]; ++e) {
+					adj[from_[e]] += a * partial_[e];
+				}
+			}
+		}
+	public:
+		tape(size_t n = 0)
+			: edge_{ 0 }, prev_(active_)
+		{
+			reserve(n);
+			active_ = this;
+		}
+		tape(const tape&) = delete;
+		tape& operator=(const tape&) = delete;
+		~tape()
+		{
+			active_ = prev_;
+		}
+
+		static tape* active()
+		{
+			return active_;
+		}
+		// Record on the active tape unless all arguments are constant.
+		static adjoint<X> apply(X x, const adjoint<X>& a, X da, const adjoint<X>& b = adjoint<X>{}, X db = 0)
+		{
+			if (a.is_constant() && b.is_constant()) {
+				return adjoint<X>(x);
+			}
+			ENSURE(active_ || !"adjoint: no active tape");
+
+			return active_->record(x, a, da, b, db);
+		}
+
+		static adjoint<X> apply(X x, std::span<const adjoint<X>> xs, std::span<const X> dx)
+		{
+			if (std::all_of(xs.begin(), xs.end(), [](const adjoint<X>& a) { return a.is_constant(); })) {
+				return adjoint<X>(x);
+			}
+			ENSURE(active_ || !"adjoint: no active tape");
+
+			return active_->record(x, xs, dx);
+		}
+
+		// Reserve space for n nodes with two parents.
+		void reserve(size_t n)
+		{
+			edge_.reserve(n + 1);
+			from_.reserve(2 * n);
+			partial_.reserve(2 * n);
+		}
+		// Number of nodes.
+		size_t size() const
+		{
+			return edge_.size() - 1;
+		}
+
+		// Checkpoint for rewind and collapse.
+		size_t mark() const
+		{
+			return size();
+		}
+		// Discard nodes recorded after mark m.
+		void rewind(size_t m)
+		{
+			ENSURE(m <= size());
+
+			from_.resize(edge_[m]);
+			partial_.resize(edge_[m]);
+			edge_.resize(m + 1);
+			if (adjoint_.size() > m) {
+				adjoint_.resize(m); // discarded nodes have no adjoints
+			}
+		}
+		void clear()
+		{
+			rewind(0);
+		}
+
+		adjoint<X> variable(X x)
+		{
+			return push(x);
+		}
+		// Node with value x and partial derivatives da with respect to a and db with respect to b.
+		adjoint<X> record(X x, const adjoint<X>& a, X da, const adjoint<X>& b = adjoint<X>{}, X db = 0)
+		{
+			if (a.is_constant() && b.is_constant()) {
+				return adjoint<X>(x);
+			}
+			edge(a, da);
+			edge(b, db);
+
+			return push(x);
+		}
+		// Node with value x and partial derivatives dx[j] with respect to xs[j].
+		adjoint<X> record(X x, std::span<const adjoint<X>> xs, std::span<const X> dx)
+		{
+			ENSURE(xs.size() == dx.size());
+
+			for (size_t j = 0; j < xs.size(); ++j) {
+				edge(xs[j], dx[j]);
+			}
+
+			return push(x);
+		}
+
+		// Sweep back from y. Use derivative to read the adjoints.
+		void gradient(const adjoint<X>& y)
+		{
+			adjoint_.assign(size(), X(0));
+			if (!y.is_constant()) {
+				adjoint_[y.i] = 1;
+				for (size_t k = y.i + 1; k-- > 0; ) {
+					sweep(k, adjoint_);
+				}
+			}
+		}
+		// Derivative of the last gradient output with respect to x.
+		X derivative(const adjoint<X>& x) const
+		{
+			return x.i < adjoint_.size() ? adjoint_[x.i] : X(0);
+		}
+
+		// Checkpoint: replace the nodes recorded after mark m by a single node for y
+		// with partial derivatives with respect to the nodes before m it depends on.
+		adjoint<X> collapse(size_t m, const adjoint<X>& y)
+		{
+			ENSURE(m <= size());
+
+			if (y.is_constant() || y.i < m) {
+				rewind(m);
+
+				return y;
+			}
+
+			// adjoints of the last gradient are kept for nodes before m
+			scratch_.resize(size());
+			for (size_t e = edge_[m]; e < from_.size(); ++e) {
+				scratch_[from_[e]] = 0;
+			}
+			std::fill(scratch_.begin() + m, scratch_.end(), X(0));
+			scratch_[y.i] = 1;
+			for (size_t k = y.i + 1; k-- > m; ) {
+				sweep(k, scratch_);
+			}
+
+			std::vector<adjoint<X>> xs;
+			std::vector<X> dx;
+			for (size_t e = edge_[m]; e < from_.size(); ++e) {
+				const size_t j = from_[e];
+				if (j < m && scratch_[j] != 0) {
+					xs.push_back(adjoint<X>(X(0), j));
+					dx.push_back(scratch_[j]);
+					scratch_[j] = 0; // once
+				}
+			}
+			rewind(m);
+
+			return record(y.x, std::span<const adjoint<X>>(xs), std::span<const X>(dx));
+		}
+	};
+
+	template<class X>
+	inline adjoint<X>& adjoint<X>::operator+=(const adjoint& y)
+	{
+		return *this = tape<X>::apply(x + y.x, *this, X(1), y, X(1));
+	}
+	template<class X>
+	inline adjoint<X>& adjoint<X>::operator-=(const adjoint& y)
+	{
+		return *this = tape<X>::apply(x - y.x, *this, X(1), y, X(-1));
+	}
+	template<class X>
+	inline adjoint<X>& adjoint<X>::operator*=(const adjoint& y)
+	{
+		return *this = tape<X>::apply(x * y.x, *this, y.x, y, x);
+	}
+	template<class X>
+	inline adjoint<X>& adjoint<X>::operator/=(const adjoint& y)
+	{
+		return *this = tape<X>::apply(x / y.x, *this, 1 / y.x, y, -x / (y.x * y.x));
+	}
+	template<class X>
+	inline adjoint<X> adjoint<X>::operator-() const
+	{
+		return tape<X>::apply(-x, *this, X(-1));
+	}
+
+	// Scalars are not deduced so 2 * x works for adjoint<double>.
+	template<class X>
+	inline adjoint<X> operator+(adjoint<X> x, const adjoint<X>& y)
+	{
+		return x += y;
+	}
+	template<class X>
+	inline adjoint<X> operator+(adjoint<X> x, std::type_identity_t<X> y)
+	{
+		return x += adjoint<X>(y);
+	}
+	template<class X>
+	inline adjoint<X> operator+(std::type_identity_t<X> x, const adjoint<X>& y)
+	{
+		return adjoint<X>(x) += y;
+	}
+	template<class X>
+	inline adjoint<X> operator-(adjoint<X> x, const adjoint<X>& y)
+	{
+		return x -= y;
+	}
+	template<class X>
+	inline adjoint<X> operator-(adjoint<X> x, std::type_identity_t<X> y)
+	{
+		return x -= adjoint<X>(y);
+	}
+	template<class X>
+	inline adjoint<X> operator-(std::type_identity_t<X> x, const adjoint<X>& y)
+	{
+		return adjoint<X>(x) -= y;
+	}
+	template<class X>
+	inline adjoint<X> operator*(adjoint<X> x, const adjoint<X>& y)
+	{
+		return x *= y;
+	}
+	template<class X>
+	inline adjoint<X> operator*(adjoint<X> x, std::type_identity_t<X> y)
+	{
+		return x *= adjoint<X>(y);
+	}
+	template<class X>
+	inline adjoint<X> operator*(std::type_identity_t<X> x, const adjoint<X>& y)
+	{
+		return adjoint<X>(x) *= y;
+	}
+	template<class X>
+	inline adjoint<X> operator/(adjoint<X> x, const adjoint<X>& y)
+	{
+		return x /= y;
+	}
+	template<class X>
+	inline adjoint<X> operator/(adjoint<X> x, std::type_identity_t<X> y)
+	{
+		return x /= adjoint<X>(y);
+	}
+	template<class X>
+	inline adjoint<X> operator/(std::type_identity_t<X> x, const adjoint<X>& y)
+	{
+		return adjoint<X>(x) /= y;
+	}
+
+	// Found by argument dependent lookup after using std::exp, etc.
+	template<class X>
+	inline adjoint<X> exp(const adjoint<X>& x)
+	{
+		const X e = std::exp(x.x);
+
+		return tape<X>::apply(e, x, e);
+	}
+	template<class X>
+	inline adjoint<X> expm1(const adjoint<X>& x)
+	{
+		const X e = std::expm1(x.x);
+
+		return tape<X>::apply(e, x, e + 1);
+	}
+	template<class X>
+	inline adjoint<X> log(const adjoint<X>& x)
+	{
+		const X l = std::log(x.x);
+
+		return tape<X>::apply(l, x, 1 / x.x);
+	}
+	// Constants use the constexpr math::sqrt so sqrt_epsilon<adjoint<X>> is a constant expression.
+	template<class X>
+	constexpr adjoint<X> sqrt(const adjoint<X>& x)
+	{
+		if (x.is_constant()) {
+			return adjoint<X>(sqrt(x.x));
+		}
+		const X s = std::sqrt(x.x);
+
+		return tape<X>::apply(s, x, 1 / (2 * s));
+	}
+	template<class X>
+	inline adjoint<X> pow(const adjoint<X>& x, std::type_identity_t<X> a)
+	{
+		const X p = std::pow(x.x, a);
+
+		return tape<X>::apply(p, x, a * std::pow(x.x, a - 1));
+	}
+
+} // namespace tmx::math
+
+// Limits of the value as a constant.
+template<class X>
+class std::numeric_limits<tmx::math::adjoint<X>> : public std::numeric_limits<X> {
+	using A = tmx::math::adjoint<X>;
+public:
+	static constexpr A min() noexcept { return std::numeric_limits<X>::min(); }
+	static constexpr A max() noexcept { return std::numeric_limits<X>::max(); }
+	static constexpr A lowest() noexcept { return std::numeric_limits<X>::lowest(); }
+	static constexpr A epsilon() noexcept { return std::numeric_limits<X>::epsilon(); }
+	static constexpr A infinity() noexcept { return std::numeric_limits<X>::infinity(); }
+	static constexpr A quiet_NaN() noexcept { return std::numeric_limits<X>::quiet_NaN(); }
+};
+
+#ifdef _DEBUG
+namespace tmx::math {
+
+	inline int adjoint_test()
+	{
+		using A = adjoint<>;
+		{
+			tape<> t;
+			const A x = A::variable(2);
+			const A y = A::variable(3);
+			const A z = x * x * y + exp(x) / y - 1;
+			assert(t.size() == 2 + 6);
+			t.gradient(z);
+			assert(t.derivative(x) == 2 * 2 * 3 + std::exp(2.) / 3);
+			assert(std::fabs(t.derivative(y) - (2 * 2 - std::exp(2.) / 9)) <= 1e-15);
+			assert(t.derivative(A(1)) == 0);
+
+			// constants are not recorded
+			const size_t m = t.mark();
+			const A c = 2 * A(3) + sqrt(A(4));
+			assert(c == A(8));
+			assert(t.size() == m);
+
+			// checkpoints
+			const A w = log(pow(x, 3.)) - sqrt(y);
+			assert(t.size() > m);
+			t.rewind(m);
+			assert(t.size() == m);
+			const A w_ = t.collapse(m, log(pow(x, 3.)) - sqrt(y) + x * z);
+			assert(t.size() == m + 1);
+			assert(w_.value() == (w + x * z).value());
+			t.gradient(w_);
+			const double dx = t.derivative(x);
+			const double dy = t.derivative(y);
+			// collapse keeps the last gradient for earlier nodes
+			const size_t m_ = t.mark();
+			const A v = t.collapse(m_, x * y + w_);
+			assert(t.derivative(x) == dx && t.derivative(y) == dy);
+			assert(t.derivative(v) == 0);
+			t.gradient(v);
+			assert(std::fabs(t.derivative(x) - (3 + dx)) <= 1e-12);
+			t.gradient(w_);
+			assert(std::fabs(t.derivative(x) - (3 / 2. + z.value() + 2 * (2 * 2 * 3 + std::exp(2.) / 3))) <= 1e-12);
+			assert(std::fabs(t.derivative(y) - (-1 / (2 * std::sqrt(3.)) + 2 * (2 * 2 - std::exp(2.) / 9))) <= 1e-12);
+		}
+		{
+			static_assert(is_adjoint_v<A> && !is_adjoint_v<double>);
+			const A nan = std::numeric_limits<A>::quiet_NaN();
+			assert(isnan(nan));
+			static_assert(sqrt_epsilon<A>.value() == sqrt_epsilon<double>);
+			assert(tape<>::active() == nullptr);
+		}
+
+		return 0;
+	}
+
+} // namespace tmx::math
+#endif // _DEBUG
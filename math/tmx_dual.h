@@ -1,126 +1,377 @@
 ﻿// tmx_dual.h - Dual numbers f(x0 + x1 ε) = f(x0) + f'(x0) x1 ε
+// With N tangents x0 + x1 ε_1 + ... + xN ε_N, where ε_i ε_j = 0, one evaluation
+// carries the partial derivatives with respect to N variables.
 #pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
 
 namespace tmx::math {
 
-	template<class X>
+	template<class X, size_t N = 1>
 	struct dual {
-		X _[2]; // x[0] + x[1]ε
-		constexpr dual(X x) 
-			: _{ x, 0 }
+		X _[N + 1]; // x[0] + x[1]ε_1 + ... + x[N]ε_N in contiguous lanes
+
+		constexpr dual(X x = 0) 
+			: _{ x }
 		{ }
-		constexpr dual(X x0, X x1) 
+		constexpr dual(X x0, X x1) requires (N == 1)
 			: _{ x0, x1 } 
 		{ }
+		constexpr dual(X x0, const std::array<X, N>& dx)
+			: _{ x0 }
+		{
+			for (size_t i = 0; i < N; ++i) {
+				_[i + 1] = dx[i];
+			}
+		}
 		constexpr dual(const dual& x) = default;
 		constexpr dual& operator=(const dual& x) = default;
 		constexpr ~dual() = default;
 
+		// x + ε_i: the i-th independent variable.
+		static constexpr dual variable(X x, size_t i = 0)
+		{
+			dual d(x);
+			d._[i + 1] = 1;
+
+			return d;
+		}
+		// f(x0) + f'(x0)(x - x0) given f(x0) and f'(x0).
+		static constexpr dual chain(X f, X df, const dual& x)
+		{
+			dual d(f);
+			for (size_t i = 1; i <= N; ++i) {
+				d._[i] = df * x._[i];
+			}
+
+			return d;
+		}
+
+		constexpr X value() const
+		{
+			return _[0];
+		}
+		// Partial derivative with respect to variable i.
+		constexpr X derivative(size_t i = 0) const
+		{
+			return _[i + 1];
+		}
+
 		constexpr bool operator==(const dual& x) const noexcept
 		{
-			return _[0] == x._[0] && _[1] == x._[1];
-		}	
+			for (size_t i = 0; i <= N; ++i) {
+				if (_[i] != x._[i]) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+		// Order by value only so solvers and curves can compare. Unlike ==, derivatives are ignored.
+		friend constexpr bool operator<(const dual& x, const dual& y) noexcept
+		{
+			return x._[0] < y._[0];
+		}
+		friend constexpr bool operator>(const dual& x, const dual& y) noexcept
+		{
+			return x._[0] > y._[0];
+		}
+		friend constexpr bool operator<=(const dual& x, const dual& y) noexcept
+		{
+			return x._[0] <= y._[0];
+		}
+		friend constexpr bool operator>=(const dual& x, const dual& y) noexcept
+		{
+			return x._[0] >= y._[0];
+		}
 
 		constexpr dual& operator+=(const dual& x)
 		{
-			_[0] += x._[0];
-			_[1] += x._[1];
+			for (size_t i = 0; i <= N; ++i) {
+				_[i] += x._[i];
+			}
 		
 			return *this;
 		}
+		constexpr dual& operator+=(X x)
+		{
+			_[0] += x;
+
+			return *this;
+		}
 		constexpr dual& operator-=(const dual& x)
 		{
-			_[0] -= x._[0];
-			_[1] -= x._[1];
+			for (size_t i = 0; i <= N; ++i) {
+				_[i] -= x._[i];
+			}
 
 			return *this;
 		}
-		constexpr dual& operator-()
+		constexpr dual& operator-=(X x)
 		{
-			_[0] = -_[0];
-			_[1] = -_[1];
+			_[0] -= x;
 
 			return *this;
 		}
+		constexpr dual operator-() const
+		{
+			dual x(*this);
+			for (size_t i = 0; i <= N; ++i) {
+				x._[i] = -x._[i];
+			}
+
+			return x;
+		}
 		constexpr dual& operator*=(const dual& x)
 		{
-			_[1] = _[0] * x._[1] + _[1] * x._[0];
+			for (size_t i = 1; i <= N; ++i) {
+				_[i] = _[0] * x._[i] + _[i] * x._[0];
+			}
 			_[0] = _[0] * x._[0];
 
 			return *this;
 		}
+		constexpr dual& operator*=(X x)
+		{
+			for (size_t i = 0; i <= N; ++i) {
+				_[i] *= x;
+			}
+
+			return *this;
+		}
 		constexpr dual& operator/=(const dual& x)
 		{
-			_[1] = (_[1] * x._[0] - _[0] * x._[1]) / (x._[0] * x._[0]);
+			for (size_t i = 1; i <= N; ++i) {
+				_[i] = (_[i] * x._[0] - _[0] * x._[i]) / (x._[0] * x._[0]);
+			}
 			_[0] = _[0] / x._[0];
 
+			return *this;
+		}
+		constexpr dual& operator/=(X x)
+		{
+			for (size_t i = 0; i <= N; ++i) {
+				_[i] /= x;
+			}
+
 			return *this;
 		}
 	};
 #ifdef _DEBUG
 	static_assert(dual{ 1, 2 } == dual{ 1, 2 });
 	static_assert(dual{ 1, 2 } != dual{ 2, 3 });
+	static_assert(dual{ 1, 2 } < dual{ 2, 1 });
+	static_assert(dual{ 1, 2 } <= dual{ 1, 3 } && dual{ 1, 2 } >= dual{ 1, 3 } && dual{ 1, 2 } != dual{ 1, 3 });
+	static_assert(0. < dual{ 1, 2 } && dual{ 1, 2 } > 0.);
 #endif // _DEBUG
 
-} // namespace tmx::math
+	template<class X>
+	struct is_dual : std::false_type {};
+	template<class X, size_t N>
+	struct is_dual<dual<X, N>> : std::true_type {};
+	template<class X>
+	constexpr bool is_dual_v = is_dual<X>::value;
 
-template<class X>
-constexpr tmx::math::dual<X> operator+(const tmx::math::dual<X>& x, const tmx::math::dual<X>& y)
-{
-	return tmx::math::dual<X>(x) += y;
-}
-template<class X>
-constexpr tmx::math::dual<X> operator-(const tmx::math::dual<X>& x, const tmx::math::dual<X>& y)
-{
-	return tmx::math::dual<X>(x) -= y;
-}
-template<class X>
-constexpr tmx::math::dual<X> operator-(const tmx::math::dual<X>& x)
-{
-	return -tmx::math::dual<X>(x);
-}
-template<class X>
-constexpr tmx::math::dual<X> operator*(const tmx::math::dual<X>& x, const tmx::math::dual<X>& y)
-{
-	return tmx::math::dual<X>(x) *= y;
-}
-template<class X>
-constexpr tmx::math::dual<X> operator/(const tmx::math::dual<X>& x, const tmx::math::dual<X>& y)
-{
-	return tmx::math::dual<X>(x) /= y;
-}
-
-// f(x0 + x1 ε) = f(x0) + f'(x0) x1 ε
-template<class F, class dF, class X>
-constexpr auto make_dual(F&& f, dF&& df)
-{
-	return [f, df](const tmx::math::dual<X>& x) { return tmx::math::dual{ f(x._[0], df(x._[0]) * x._[1]) }; };
-}
-
-static_assert(tmx::math::dual{ 1, 2 } + tmx::math::dual{ 3, 4 } == tmx::math::dual{ 4, 6 });
-static_assert(tmx::math::dual{ 1, 2 } - tmx::math::dual{ 3, 4 } == tmx::math::dual{ -2, -2 });
-static_assert(-tmx::math::dual{ 1, 2 } == tmx::math::dual{ -1, -2 });
-static_assert(tmx::math::dual{ 1, 2 } * tmx::math::dual{ 3, 4 } == tmx::math::dual{ 3, 10 });
-static_assert(tmx::math::dual{ 3, 4 } / tmx::math::dual{ 1, 2 } == tmx::math::dual{ 3, -2 });
+	// Scalars are not deduced so 2 * x works for dual<double>.
+	template<class X, size_t N>
+	constexpr dual<X, N> operator+(dual<X, N> x, const dual<X, N>& y)
+	{
+		return x += y;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator+(dual<X, N> x, std::type_identity_t<X> y)
+	{
+		return x += y;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator+(std::type_identity_t<X> x, dual<X, N> y)
+	{
+		return y += x;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator-(dual<X, N> x, const dual<X, N>& y)
+	{
+		return x -= y;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator-(dual<X, N> x, std::type_identity_t<X> y)
+	{
+		return x -= y;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator-(std::type_identity_t<X> x, const dual<X, N>& y)
+	{
+		return -y += x;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator*(dual<X, N> x, const dual<X, N>& y)
+	{
+		return x *= y;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator*(dual<X, N> x, std::type_identity_t<X> y)
+	{
+		return x *= y;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator*(std::type_identity_t<X> x, dual<X, N> y)
+	{
+		return y *= x;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator/(dual<X, N> x, const dual<X, N>& y)
+	{
+		return x /= y;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator/(dual<X, N> x, std::type_identity_t<X> y)
+	{
+		return x /= y;
+	}
+	template<class X, size_t N>
+	constexpr dual<X, N> operator/(std::type_identity_t<X> x, const dual<X, N>& y)
+	{
+		return dual<X, N>(x) /= y;
+	}
 
-#ifdef _DEBUG
-inline int test_math_dual()
-{
-	using namespace tmx::math;
+	// Found by argument dependent lookup after using std::exp, etc.
+	template<class X, size_t N>
+	inline dual<X, N> exp(const dual<X, N>& x)
+	{
+		const X e = std::exp(x._[0]);
+
+		return dual<X, N>::chain(e, e, x);
+	}
+	template<class X, size_t N>
+	inline dual<X, N> expm1(const dual<X, N>& x)
+	{
+		return dual<X, N>::chain(std::expm1(x._[0]), std::exp(x._[0]), x);
+	}
+	template<class X, size_t N>
+	inline dual<X, N> log(const dual<X, N>& x)
+	{
+		return dual<X, N>::chain(std::log(x._[0]), 1 / x._[0], x);
+	}
+	template<class X, size_t N>
+	inline dual<X, N> sqrt(const dual<X, N>& x)
+	{
+		const X s = std::sqrt(x._[0]);
+
+		return dual<X, N>::chain(s, 1 / (2 * s), x);
+	}
+	template<class X, size_t N>
+	inline dual<X, N> pow(const dual<X, N>& x, std::type_identity_t<X> a)
+	{
+		return dual<X, N>::chain(std::pow(x._[0], a), a * std::pow(x._[0], a - 1), x);
+	}
+	template<class X, size_t N>
+	inline dual<X, N> pow(std::type_identity_t<X> a, const dual<X, N>& y)
+	{
+		const X p = std::pow(a, y._[0]);
 
+		return dual<X, N>::chain(p, p * std::log(a), y);
+	}
+	template<class X, size_t N>
+	inline dual<X, N> pow(const dual<X, N>& x, const dual<X, N>& y)
 	{
-		// dx^2/dx = 2x
-		constexpr dual d = [](auto x) { return x * x; }(dual{ 2, 1 });
-		static_assert(d._[0] == 4);
-		static_assert(d._[1] == 4);
+		return exp(y * log(x));
 	}
+
+	// f(x0 + x1 ε) = f(x0) + f'(x0) x1 ε
+	template<class F, class dF>
+	constexpr auto make_dual(F&& f, dF&& df)
 	{
-		// dx^3/dx = 3x^2
-		constexpr dual d = [](auto x) { return x * x * x; }(dual{ 2, 1 });
-		static_assert(d._[0] == 8);
-		static_assert(d._[1] == 12);
+		return [f, df]<class X, size_t N>(const dual<X, N>& x) { return dual<X, N>::chain(f(x._[0]), df(x._[0]), x); };
 	}
 
-	return 0;
-}
+	static_assert(dual{ 1, 2 } + dual{ 3, 4 } == dual{ 4, 6 });
+	static_assert(dual{ 1, 2 } - dual{ 3, 4 } == dual{ -2, -2 });
+	static_assert(-dual{ 1, 2 } == dual{ -1, -2 });
+	static_assert(dual{ 1, 2 } * dual{ 3, 4 } == dual{ 3, 10 });
+	static_assert(dual{ 3, 4 } / dual{ 1, 2 } == dual{ 3, -2 });
+	static_assert(2 * dual{ 1., 2. } == dual{ 2., 4. });
+	static_assert(1 - dual{ 1., 2. } == dual{ 0., -2. });
+	static_assert(1 / dual{ 2., 1. } == dual{ .5, -.25 });
+
+} // namespace tmx::math
+
+// Limits of the value lane with zero tangents.
+template<class X, size_t N>
+class std::numeric_limits<tmx::math::dual<X, N>> : public std::numeric_limits<X> {
+	using D = tmx::math::dual<X, N>;
+public:
+	static constexpr D min() noexcept { return std::numeric_limits<X>::min(); }
+	static constexpr D max() noexcept { return std::numeric_limits<X>::max(); }
+	static constexpr D lowest() noexcept { return std::numeric_limits<X>::lowest(); }
+	static constexpr D epsilon() noexcept { return std::numeric_limits<X>::epsilon(); }
+	static constexpr D infinity() noexcept { return std::numeric_limits<X>::infinity(); }
+	static constexpr D quiet_NaN() noexcept { return std::numeric_limits<X>::quiet_NaN(); }
+};
+
+#ifdef _DEBUG
+namespace tmx::math {
+
+	inline int dual_test()
+	{
+		{
+			// dx^2/dx = 2x
+			constexpr dual d = [](auto x) { return x * x; }(dual{ 2, 1 });
+			static_assert(d._[0] == 4);
+			static_assert(d._[1] == 4);
+		}
+		{
+			// dx^3/dx = 3x^2
+			constexpr dual d = [](auto x) { return x * x * x; }(dual{ 2, 1 });
+			static_assert(d._[0] == 8);
+			static_assert(d._[1] == 12);
+		}
+		{
+			// f(x, y) = x^2 y + y/x has gradient (2xy - y/x^2, x^2 + 1/x)
+			using D = dual<double, 2>;
+			constexpr D x = D::variable(2, 0);
+			constexpr D y = D::variable(3, 1);
+			constexpr D f = x * x * y + y / x;
+			static_assert(f.value() == 12 + 1.5);
+			static_assert(f.derivative(0) == 12 - .75);
+			static_assert(f.derivative(1) == 4 + .5);
+		}
+		{
+			using D = dual<double, 3>;
+			const D x = D(.5, { 1, 2, 3 });
+			const double eps = 1e-15;
+
+			const D e = exp(x);
+			for (size_t i = 0; i < 3; ++i) {
+				assert(std::fabs(e.derivative(i) - std::exp(.5) * (i + 1)) <= eps);
+			}
+			const D l = log(exp(x));
+			for (size_t i = 0; i < 3; ++i) {
+				assert(std::fabs(l.derivative(i) - x.derivative(i)) <= eps);
+			}
+			const D p = pow(x, 3.);
+			assert(std::fabs(p.value() - .125) <= eps);
+			assert(std::fabs(p.derivative(1) - 3 * .25 * 2) <= eps);
+			const D q = pow(x, x); // d x^x = x^x(log x + 1) dx
+			assert(std::fabs(q.derivative(0) - std::pow(.5, .5) * (std::log(.5) + 1)) <= eps);
+			assert(std::fabs(sqrt(x * x).derivative(2) - 3) <= eps);
+			assert(std::fabs(make_dual([](double a) { return std::sin(a); }, [](double a) { return std::cos(a); })(x).derivative(0) - std::cos(.5)) <= eps);
+		}
+		{
+			using D = dual<double, 2>;
+			const D nan = std::numeric_limits<D>::quiet_NaN();
+			assert(nan != nan);
+			static_assert(std::numeric_limits<D>::infinity() > D(1e300));
+			static_assert(is_dual_v<D> && !is_dual_v<double>);
+		}
+
+		return 0;
+	}
+
+} // namespace tmx::math
 #endif // _DEBUG
@@ -0,0 +1,356 @@
+// tmx_hyperdual.h - Second order dual numbers.
+// f(x + dx) = f(x) + f'(x) dx + f''(x) dx^2/2 truncated after second order terms.
+// With N variables this carries the value, gradient, and Hessian through one evaluation.
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+
+namespace tmx::math {
+
+	template<class X, size_t N = 1>
+	struct hyperdual {
+		static constexpr size_t M = N * (N + 1) / 2; // Hessian entries
+		// value, gradient, and lower triangular Hessian packed by rows
+		// _[1 + N + k(k + 1)/2 + j] = d^2/dx_k dx_j for j <= k
+		X _[1 + N + M];
+
+		constexpr hyperdual(X x = 0)
+			: _{ x }
+		{ }
+		constexpr hyperdual(const hyperdual& x) = default;
+		constexpr hyperdual& operator=(const hyperdual& x) = default;
+		constexpr ~hyperdual() = default;
+
+		// x + dx_i: the i-th independent variable.
+		static constexpr hyperdual variable(X x, size_t i = 0)
+		{
+			hyperdual d(x);
+			d._[1 + i] = 1;
+
+			return d;
+		}
+		// f(x0) + f'(x0)(x - x0) + f''(x0)(x - x0)^2/2 given f, f', and f'' at x0.
+		static constexpr hyperdual chain(X f, X df, X ddf, const hyperdual& x)
+		{
+			hyperdual d(f);
+			for (size_t k = 0; k < N; ++k) {
+				d._[1 + k] = df * x._[1 + k];
+				for (size_t j = 0; j <= k; ++j) {
+					d.H(k, j) = df * x.H(k, j) + ddf * x._[1 + k] * x._[1 + j];
+				}
+			}
+
+			return d;
+		}
+
+		constexpr X value() const
+		{
+			return _[0];
+		}
+		// Partial derivative with respect to variable i.
+		constexpr X gradient(size_t i) const
+		{
+			return _[1 + i];
+		}
+		// Second partial derivative with respect to variables i and j.
+		constexpr X hessian(size_t i, size_t j) const
+		{
+			return i >= j ? H(i, j) : H(j, i);
+		}
+
+		constexpr bool operator==(const hyperdual& x) const noexcept
+		{
+			for (size_t i = 0; i < 1 + N + M; ++i) {
+				if (_[i] != x._[i]) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+		// Order by value only so solvers and curves can compare. Unlike ==, derivatives are ignored.
+		friend constexpr bool operator<(const hyperdual& x, const hyperdual& y) noexcept
+		{
+			return x._[0] < y._[0];
+		}
+		friend constexpr bool operator>(const hyperdual& x, const hyperdual& y) noexcept
+		{
+			return x._[0] > y._[0];
+		}
+		friend constexpr bool operator<=(const hyperdual& x, const hyperdual& y) noexcept
+		{
+			return x._[0] <= y._[0];
+		}
+		friend constexpr bool operator>=(const hyperdual& x, const hyperdual& y) noexcept
+		{
+			return x._[0] >= y._[0];
+		}
+
+		constexpr hyperdual& operator+=(const hyperdual& x)
+		{
+			for (size_t i = 0; i < 1 + N + M; ++i) {
+				_[i] += x._[i];
+			}
+
+			return *this;
+		}
+		constexpr hyperdual& operator+=(X x)
+		{
+			_[0] += x;
+
+			return *this;
+		}
+		constexpr hyperdual& operator-=(const hyperdual& x)
+		{
+			for (size_t i = 0; i < 1 + N + M; ++i) {
+				_[i] -= x._[i];
+			}
+
+			return *this;
+		}
+		constexpr hyperdual& operator-=(X x)
+		{
+			_[0] -= x;
+
+			return *this;
+		}
+		constexpr hyperdual operator-() const
+		{
+			hyperdual x(*this);
+			for (size_t i = 0; i < 1 + N + M; ++i) {
+				x._[i] = -x._[i];
+			}
+
+			return x;
+		}
+		constexpr hyperdual& operator*=(const hyperdual& x)
+		{
+			for (size_t k = 0; k < N; ++k) {
+				for (size_t j = 0; j <= k; ++j) {
+					H(k, j) = _[0] * x.H(k, j) + H(k, j) * x._[0]
+						+ _[1 + k] * x._[1 + j] + _[1 + j] * x._[1 + k];
+				}
+			}
+			for (size_t k = 1; k <= N; ++k) {
+				_[k] = _[0] * x._[k] + _[k] * x._[0];
+			}
+			_[0] = _[0] * x._[0];
+
+			return *this;
+		}
+		constexpr hyperdual& operator*=(X x)
+		{
+			for (size_t i = 0; i < 1 + N + M; ++i) {
+				_[i] *= x;
+			}
+
+			return *this;
+		}
+		// 1/x has derivatives -1/x^2 and 2/x^3.
+		constexpr hyperdual& operator/=(const hyperdual& x)
+		{
+			const X r = 1 / x._[0];
+
+			return *this *= chain(r, -r * r, 2 * r * r * r, x);
+		}
+		constexpr hyperdual& operator/=(X x)
+		{
+			for (size_t i = 0; i < 1 + N + M; ++i) {
+				_[i] /= x;
+			}
+
+			return *this;
+		}
+	private:
+		constexpr X& H(size_t k, size_t j)
+		{
+			return _[1 + N + k * (k + 1) / 2 + j];
+		}
+		constexpr const X& H(size_t k, size_t j) const
+		{
+			return _[1 + N + k * (k + 1) / 2 + j];
+		}
+	};
+
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator+(hyperdual<X, N> x, const hyperdual<X, N>& y)
+	{
+		return x += y;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator+(hyperdual<X, N> x, std::type_identity_t<X> y)
+	{
+		return x += y;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator+(std::type_identity_t<X> x, hyperdual<X, N> y)
+	{
+		return y += x;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator-(hyperdual<X, N> x, const hyperdual<X, N>& y)
+	{
+		return x -= y;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator-(hyperdual<X, N> x, std::type_identity_t<X> y)
+	{
+		return x -= y;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator-(std::type_identity_t<X> x, const hyperdual<X, N>& y)
+	{
+		return -y += x;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator*(hyperdual<X, N> x, const hyperdual<X, N>& y)
+	{
+		return x *= y;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator*(hyperdual<X, N> x, std::type_identity_t<X> y)
+	{
+		return x *= y;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator*(std::type_identity_t<X> x, hyperdual<X, N> y)
+	{
+		return y *= x;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator/(hyperdual<X, N> x, const hyperdual<X, N>& y)
+	{
+		return x /= y;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator/(hyperdual<X, N> x, std::type_identity_t<X> y)
+	{
+		return x /= y;
+	}
+	template<class X, size_t N>
+	constexpr hyperdual<X, N> operator/(std::type_identity_t<X> x, const hyperdual<X, N>& y)
+	{
+		return hyperdual<X, N>(x) /= y;
+	}
+
+	// Found by argument dependent lookup after using std::exp, etc.
+	template<class X, size_t N>
+	inline hyperdual<X, N> exp(const hyperdual<X, N>& x)
+	{
+		const X e = std::exp(x._[0]);
+
+		return hyperdual<X, N>::chain(e, e, e, x);
+	}
+	template<class X, size_t N>
+	inline hyperdual<X, N> expm1(const hyperdual<X, N>& x)
+	{
+		const X e = std::exp(x._[0]);
+
+		return hyperdual<X, N>::chain(std::expm1(x._[0]), e, e, x);
+	}
+	template<class X, size_t N>
+	inline hyperdual<X, N> log(const hyperdual<X, N>& x)
+	{
+		const X r = 1 / x._[0];
+
+		return hyperdual<X, N>::chain(std::log(x._[0]), r, -r * r, x);
+	}
+	template<class X, size_t N>
+	inline hyperdual<X, N> sqrt(const hyperdual<X, N>& x)
+	{
+		const X s = std::sqrt(x._[0]);
+
+		return hyperdual<X, N>::chain(s, 1 / (2 * s), -1 / (4 * s * x._[0]), x);
+	}
+	template<class X, size_t N>
+	inline hyperdual<X, N> pow(const hyperdual<X, N>& x, std::type_identity_t<X> a)
+	{
+		const X x0 = x._[0];
+
+		return hyperdual<X, N>::chain(std::pow(x0, a), a * std::pow(x0, a - 1), a * (a - 1) * std::pow(x0, a - 2), x);
+	}
+
+} // namespace tmx::math
+
+// Limits of the value with zero derivatives.
+template<class X, size_t N>
+class std::numeric_limits<tmx::math::hyperdual<X, N>> : public std::numeric_limits<X> {
+	using D = tmx::math::hyperdual<X, N>;
+public:
+	static constexpr D min() noexcept { return std::numeric_limits<X>::min(); }
+	static constexpr D max() noexcept { return std::numeric_limits<X>::max(); }
+	static constexpr D lowest() noexcept { return std::numeric_limits<X>::lowest(); }
+	static constexpr D epsilon() noexcept { return std::numeric_limits<X>::epsilon(); }
+	static constexpr D infinity() noexcept { return std::numeric_limits<X>::infinity(); }
+	static constexpr D quiet_NaN() noexcept { return std::numeric_limits<X>::quiet_NaN(); }
+};
+
+#ifdef _DEBUG
+namespace tmx::math {
+
+	inline int hyperdual_test()
+	{
+		{
+			// f(x, y) = x^2 y + y/x
+			using D = hyperdual<double, 2>;
+			constexpr D x = D::variable(2, 0);
+			constexpr D y = D::variable(3, 1);
+			constexpr D f = x * x * y + y / x;
+			static_assert(f.value() == 12 + 1.5);
+			static_assert(f.gradient(0) == 12 - .75);  // 2xy - y/x^2
+			static_assert(f.gradient(1) == 4 + .5);    // x^2 + 1/x
+			static_assert(f.hessian(0, 0) == 6 + .75); // 2y + 2y/x^3
+			static_assert(f.hessian(0, 1) == 4 - .25); // 2x - 1/x^2
+			static_assert(f.hessian(1, 0) == f.hessian(0, 1));
+			static_assert(f.hessian(1, 1) == 0);
+		}
+		{
+			// order by value, equality of every part
+			using D = hyperdual<double, 1>;
+			static_assert(D::variable(1) < D(2) && D(2) > D::variable(1));
+			static_assert(D::variable(1) <= D(1) && D::variable(1) >= D(1) && D::variable(1) != D(1));
+			static_assert(0. < D(1));
+		}
+		{
+			// f(x, y) = exp(x y) has Hessian exp(xy) [y^2, 1 + xy; 1 + xy, x^2]
+			using D = hyperdual<double, 2>;
+			const D x = D::variable(.5, 0);
+			const D y = D::variable(.25, 1);
+			const D f = exp(x * y);
+			const double e = std::exp(.125);
+			const double eps = 1e-15;
+			assert(std::fabs(f.hessian(0, 0) - e * .25 * .25) <= eps);
+			assert(std::fabs(f.hessian(0, 1) - e * (1 + .125)) <= eps);
+			assert(std::fabs(f.hessian(1, 1) - e * .5 * .5) <= eps);
+
+			const D l = log(x * y);
+			assert(std::fabs(l.hessian(0, 0) + 1 / .25) <= eps);
+			assert(std::fabs(l.hessian(0, 1)) <= eps);
+			const D p = pow(x, 3.);
+			assert(std::fabs(p.hessian(0, 0) - 6 * .5) <= eps);
+			// finite at 0 for 0 < a < 2
+			const D x0 = D::variable(0, 0);
+			const D p15 = pow(x0, 1.5);
+			assert(p15.value() == 0 && p15.gradient(0) == 0);
+			const D p2 = pow(x0, 2.);
+			assert(p2.value() == 0 && p2.gradient(0) == 0 && p2.hessian(0, 0) == 2);
+			const D s = sqrt(y);
+			assert(std::fabs(s.hessian(1, 1) + 1 / (4 * std::pow(.25, 1.5))) <= eps);
+			assert(std::fabs(expm1(x).hessian(0, 0) - std::exp(.5)) <= eps);
+		}
+		{
+			using D = hyperdual<double, 3>;
+			const D nan = std::numeric_limits<D>::quiet_NaN();
+			assert(nan != nan);
+		}
+
+		return 0;
+	}
+
+} // namespace tmx::math
+#endif // _DEBUG
@@ -1,6 +1,10 @@
 // fmx_root1d.h - 1-d root using secant method
 #pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
 #include <tuple>
+#include <utility>
 #include "tmx_math.h"
 
 namespace tmx::root1d {
@@ -125,6 +129,25 @@ namespace tmx::root1d {
 
 			return { x0, y0, n };
 		}
+
+		// Find root in [a, b] given function returning value and derivative in one call.
+		template<class FdF>
+			requires requires(const FdF& fdf, X x) { std::get<1>(fdf(x)); }
+		constexpr std::tuple<X,X,size_t> solve(const FdF& fdf, X a = -math::infinity<X>, X b = math::infinity<X>)
+		{
+			auto [y0, dy0] = fdf(x0);
+			size_t n = 0;
+			while (++n < iterations && math::fabs(y0) > tolerance) {
+				auto x = next(x0, y0, dy0);
+				x0 = bracket(x, x0, a, b);
+				std::tie(y0, dy0) = fdf(x0);
+			}
+			if (n == iterations) {
+				x0 = std::numeric_limits<X>::quiet_NaN();
+			}
+
+			return { x0, y0, n };
+		}
 #ifdef _DEBUG
 		constexpr int solve_test()
 		{
@@ -138,6 +161,24 @@ namespace tmx::root1d {
 #endif // _DEBUG	
 	};
 
+#ifdef _DEBUG
+	inline int newton_test()
+	{
+		{
+			auto [x, y, n] = newton(1.).solve([](double x) { return std::pair(x * x - 4, 2 * x); });
+			assert(math::fabs(x - 2) <= math::sqrt_epsilon<double>);
+			assert(math::fabs(y) <= math::sqrt_epsilon<double>);
+			assert(n < 10);
+		}
+		{
+			auto [x, y, n] = newton(1.).solve([](double x) { return std::pair(x * x - 4, 2 * x); }, 0., 3.);
+			assert(math::fabs(x - 2) <= math::sqrt_epsilon<double>);
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
 } // namespace fms::secant
 
 
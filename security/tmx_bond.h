@@ -1,10 +1,13 @@
 // tmx_bond.h - Bonds
 #pragma once
+#include <span>
+#include <thread>
 #include "date/tmx_date_business_day.h"
 #include "date/tmx_date_day_count.h"
 #include "date/tmx_date_holiday_calendar.h"
 #include "date/tmx_date_periodic.h"
 #include "instrument/tmx_instrument.h"
+#include "instrument/tmx_instrument_portfolio.h"
 
 namespace tmx::security {
 
@@ -94,6 +97,14 @@ namespace tmx::security {
 
 		return merge(interest(bond, pvdate), principal(bond, pvdate));
 	}
+	// Cash flows of bonds from present value date in one contiguous store built using threads.
+	template<class C = double, class F = double>
+	inline auto portfolio(std::span<const bond<C, F>> bonds, const date::ymd& pvdate,
+		unsigned threads = std::thread::hardware_concurrency())
+	{
+		return instrument::portfolio<double, F>(bonds.size(),
+			[bonds, pvdate](size_t j) { return instrument(bonds[j], pvdate); }, threads);
+	}
 #ifdef _DEBUG
 
 	inline int bond_test()
@@ -175,6 +186,33 @@ namespace tmx::security {
 			assert(cn.u == diffyears(b0.maturity, pvdate));
 			assert(cn.c == 2.5);
 		}
+		{
+			const bond<> bs[] = {
+				b0,
+				bond<>{ d, d + years(2), 0.04, frequency::quarterly },
+				bond<>{ d, d + months(6), 0.03 },
+			};
+			const auto p = portfolio(std::span<const bond<>>(bs), d, 2);
+			assert(3 == p.size());
+			const auto cf = p.columns();
+			for (size_t j = 0; j < 3; ++j) {
+				auto i = instrument(bs[j], d);
+				assert(cf.size(j) == size(i));
+				for (size_t k = 0; k < cf.size(j); ++k, ++i) {
+					assert(cf.time(j)[k] == (*i).u);
+					assert(cf.cash(j)[k] == (*i).c);
+				}
+			}
+			// same as appending in order
+			instrument::portfolio<> p_;
+			for (const auto& b : bs) {
+				p_.push_back(instrument(b, d));
+			}
+			const auto cf_ = p_.columns();
+			assert(std::equal(cf.offset.begin(), cf.offset.end(), cf_.offset.begin(), cf_.offset.end()));
+			assert(std::equal(cf.u.begin(), cf.u.end(), cf_.u.begin(), cf_.u.end()));
+			assert(std::equal(cf.c.begin(), cf.c.end(), cf_.c.begin(), cf_.c.end()));
+		}
 
 		return 0;
 	}
@@ -1,8 +1,20 @@
 // tmx_valuation.h - present value, duration, convexity, yield, oas
 #pragma once
+#include <array>
 #include <cmath>
+#include <span>
+#include <type_traits>
+#include <vector>
 #include "curve/tmx_curve.h"
+#include "curve/tmx_curve_pwflat.h"
+#include "curve/tmx_curve_crtp.h"
 #include "instrument/tmx_instrument.h"
+#include "instrument/tmx_instrument_fixed.h"
+#include "instrument/tmx_instrument_regular.h"
+#include "instrument/tmx_instrument_table.h"
+#include "math/tmx_adjoint.h"
+#include "math/tmx_dual.h"
+#include "math/tmx_hyperdual.h"
 #include "math/tmx_root1d.h"
 
 using namespace fms::iterable;
@@ -22,8 +34,8 @@ namespace tmx::value {
 	}
 
 	// Present value at t of a zero coupon bond with cash flow c at time u.
-	template<class U, class C, class T, class F>
-	constexpr C present(const instrument::cash_flow<U, C>& uc, const curve::interface<T, F>& f) 
+	template<class U, class C, curve::forward_curve Curve>
+	constexpr auto present(const instrument::cash_flow<U, C>& uc, const Curve& f)
 	{
 		return uc.c * f.discount(uc.u);
 	}
@@ -32,8 +44,8 @@ namespace tmx::value {
 #endif // _DEBUG
 
 	// Present value at of discounted cash flows.
-	template<class IU, class IC, class T, class F>
-	auto present(instrument::iterable<IU,IC> i, const curve::interface<T, F>& f)
+	template<class IU, class IC, curve::forward_curve Curve>
+	auto present(instrument::iterable<IU,IC> i, const Curve& f)
 	{
 		return sum(apply([&f](const auto& uc) { return present(uc, f); }, i));
 	}
@@ -41,71 +53,656 @@ namespace tmx::value {
 	//static_assert(present<int,int,int,int>(instrument::zero_coupon_bond(1, 2), curve::constant(0)) == 2);
 #endif // _DEBUG
 
+	// Present value of cash flows c at times u using batch discounts.
+	template<class U, class C, class T, class F>
+	inline C present(std::span<const U> u, std::span<const C> c, const curve::interface<T, F>& f)
+	{
+		ENSURE(u.size() == c.size());
+
+		C pv = 0;
+		std::array<F, curve::batch_size> D;
+		for (size_t i = 0; i < u.size(); i += curve::batch_size) {
+			const size_t n = std::min(curve::batch_size, u.size() - i);
+			f.discount(u.subspan(i, n), std::span<F>(D.data(), n));
+			for (size_t j = 0; j < n; ++j) {
+				pv += c[i + j] * D[j];
+			}
+		}
+
+		return pv;
+	}
+
+	// Present value using a cursor since cash flow times are non-decreasing.
+	template<class IU, class IC, class T, class F>
+	inline auto present(instrument::iterable<IU, IC> i, const curve::pwflat<T, F>& f)
+	{
+		auto D = f.cursor();
+		decltype(std::iter_value_t<IC>{} * F{}) pv = 0;
+
+		while (i) {
+			const auto uc = *i;
+			pv += uc.c * D.discount(uc.u);
+			++i;
+		}
+
+		return pv;
+	}
+
 	// TODO: risky_present(i, f, T, R) ...
 
 	// Derivative of present value with respect to a parallel shift.
-	template<class IU, class IC, class T, class F>
-	constexpr auto duration(instrument::iterable<IU, IC> i, const curve::interface<T, F>& f)
+	template<class IU, class IC, curve::forward_curve Curve>
+	constexpr auto duration(instrument::iterable<IU, IC> i, const Curve& f)
 	{
 		return sum(apply([&f](const auto& uc) { return -(uc.u) * present(uc, f); }, i));
 	}
 
-	// Duration divided by present value.
 	template<class IU, class IC, class T, class F>
-	constexpr auto macaulay_duration(instrument::iterable<IU, IC> i, const curve::interface<T, F>& f)
+	inline auto duration(instrument::iterable<IU, IC> i, const curve::pwflat<T, F>& f)
+	{
+		auto D = f.cursor();
+		decltype(std::iter_value_t<IC>{} * F{}) dur = 0;
+
+		while (i) {
+			const auto uc = *i;
+			dur -= uc.u * uc.c * D.discount(uc.u);
+			++i;
+		}
+
+		return dur;
+	}
+
+	// Duration divided by present value.
+	template<class IU, class IC, curve::forward_curve Curve>
+	constexpr auto macaulay_duration(instrument::iterable<IU, IC> i, const Curve& f)
 	{
 		return duration(i, f)/ present(i, f);
 	}
 
 	// Second derivative of present value with respect to a parallel shift.
-	template<class IU, class IC, class T, class F>
-	constexpr auto convexity(instrument::iterable<IU, IC> i, const curve::interface<T, F>& f)
+	template<class IU, class IC, curve::forward_curve Curve>
+	constexpr auto convexity(instrument::iterable<IU, IC> i, const Curve& f)
 	{
 		return sum(apply([&f](const auto& uc) { return uc.u * uc.u * present(uc, f); }, i));
 	}
 
+	template<class IU, class IC, class T, class F>
+	inline auto convexity(instrument::iterable<IU, IC> i, const curve::pwflat<T, F>& f)
+	{
+		auto D = f.cursor();
+		decltype(std::iter_value_t<IC>{} * F{}) cvx = 0;
+
+		while (i) {
+			const auto uc = *i;
+			cvx += uc.u * uc.u * uc.c * D.discount(uc.u);
+			++i;
+		}
+
+		return cvx;
+	}
+
+	// Present value, duration, convexity, and Macaulay duration.
+	template<class X = double>
+	struct risk_measures {
+		X present = 0;
+		X duration = 0;
+		X convexity = 0;
+		X macaulay_duration = 0;
+	};
+
+	// Risk measures in one pass using one discount D(u) per cash flow.
+	template<class IU, class IC, class D>
+	constexpr auto risk_discount(instrument::iterable<IU, IC> i, D&& discount)
+	{
+		risk_measures<decltype(std::iter_value_t<IC>{} * discount(std::iter_value_t<IU>{}))> r;
+
+		while (i) {
+			const auto [u, c] = *i;
+			const auto cD = c * discount(u);
+			r.present += cD;
+			r.duration -= u * cD;
+			r.convexity += u * u * cD;
+			++i;
+		}
+		r.macaulay_duration = r.duration / r.present;
+
+		return r;
+	}
+	template<class IU, class IC, curve::forward_curve Curve>
+	constexpr auto risk(instrument::iterable<IU, IC> i, const Curve& f)
+	{
+		return risk_discount(i, [&f](auto u) { return f.discount(u); });
+	}
+	template<class IU, class IC, class T, class F>
+	inline auto risk(instrument::iterable<IU, IC> i, const curve::pwflat<T, F>& f)
+	{
+		auto D = f.cursor();
+
+		return risk_discount(i, [&D](auto u) { return D.discount(u); });
+	}
+	// Risk measures of each instrument in a portfolio.
+	template<class I, curve::forward_curve Curve, class X>
+	inline void risk(std::span<const I> is, const Curve& f, std::span<risk_measures<X>> rs)
+	{
+		ENSURE(is.size() == rs.size());
+
+		for (size_t j = 0; j < is.size(); ++j) {
+			rs[j] = risk(is[j], f);
+		}
+	}
+
+	// Add q times the derivative of present value with respect to each rate of the curve
+	// with knots t and cursor D to dv and return the present value.
+	// dv[k] is for the segment (t[k-1], t[k]] and dv[t.size()] for the extrapolated rate.
+	// Uses dD(u)/df[k] = -D(u) |(t[k-1], t[k]] ∩ (0, u]| in one pass over the cash flows.
+	template<class IU, class IC, class T, class F, class X>
+	inline X key_rate_durations(instrument::iterable<IU, IC> i, tmx::pwflat::cursor<T, F> D,
+		std::span<const T> t, std::span<X> dv, X q = 1)
+	{
+		const size_t n = t.size();
+		ENSURE(dv.size() == n + 1);
+
+		thread_local std::vector<X> A; // sum of cD in segment k
+		A.assign(n + 1, X(0));
+
+		X pv = 0;
+		while (i) {
+			const auto [u, c] = *i;
+			const X cD = c * D.discount(u);
+			const size_t k = D.segment();
+			pv += cD;
+			A[k] += cD;
+			dv[k] -= q * cD * (u - D.start());
+			++i;
+		}
+		// cash flows after segment k use all of it
+		X A_ = 0;
+		for (size_t k = n; k-- > 0; ) {
+			A_ += A[k + 1];
+			dv[k] -= q * A_ * (t[k] - (k ? t[k - 1] : T(0)));
+		}
+
+		return pv;
+	}
+	// Add q times the derivative of present value with respect to each rate of f to dv.
+	template<class IU, class IC, class T, class F, class X>
+	inline void key_rate_durations(instrument::iterable<IU, IC> i, const curve::pwflat<T, F>& f,
+		std::span<X> dv, X q = 1)
+	{
+		thread_local std::vector<T> t; // knot times
+		t.clear();
+		f.breaks(t);
+
+		key_rate_durations(i, f.cursor(), std::span<const T>(t), dv, q);
+	}
+	template<class IU, class IC, class T, class F>
+	inline std::vector<F> key_rate_durations(instrument::iterable<IU, IC> i, const curve::pwflat<T, F>& f)
+	{
+		std::vector<F> dv(f.size() + 1, F(0));
+
+		key_rate_durations(i, f, std::span<F>(dv));
+
+		return dv;
+	}
+	// Key rate durations of a portfolio with quantity qs[j] of instrument is[j].
+	template<class I, class T, class F>
+	inline std::vector<F> key_rate_durations(std::span<const I> is, std::span<const F> qs, const curve::pwflat<T, F>& f)
+	{
+		ENSURE(is.size() == qs.size());
+
+		std::vector<T> t; // knot times
+		f.breaks(t);
+		std::vector<F> dv(f.size() + 1, F(0));
+		for (size_t j = 0; j < is.size(); ++j) {
+			key_rate_durations(is[j], f.cursor(), std::span<const T>(t), std::span<F>(dv), qs[j]);
+		}
+
+		return dv;
+	}
+
+	// Present value on a curve with adjoint rates recorded as one node on the active tape
+	// whose partial derivatives are the key rate durations.
+	template<class IU, class IC, class T, class X>
+	inline math::adjoint<X> present(instrument::iterable<IU, IC> i, const curve::pwflat<T, math::adjoint<X>>& f)
+	{
+		using A = math::adjoint<X>;
+
+		const size_t n = f.size();
+		thread_local std::vector<T> t;
+		thread_local std::vector<A> r;
+		thread_local std::vector<X> r_, dv;
+		t.clear();
+		f.breaks(t);
+		r.clear();
+		r_.clear();
+		for (auto fi = f.rate(); fi; ++fi) {
+			r.push_back(*fi);
+			r_.push_back((*fi).value());
+		}
+		r.push_back(f.extrapolation());
+		r_.push_back(r.back().value());
+		dv.assign(n + 1, X(0));
+
+		const X pv = key_rate_durations(i, tmx::pwflat::cursor<T, X>(n, t.data(), r_.data(), r_[n]),
+			std::span<const T>(t), std::span<X>(dv));
+
+		return math::tape<X>::apply(pv, std::span<const A>(r), std::span<const X>(dv));
+	}
+
+	// Derivatives h'(z) and h''(z) of h(z) = log((1 - exp(-z))/z).
+	// Closed form 1/expm1(z) - 1/z cancels near 0 so small z uses the Bernoulli series.
+	template<class C>
+	inline std::array<C, 2> geometric_log_derivatives(C z)
+	{
+		if (std::fabs(z) < 1) {
+			// B_2k/(2k)! for k = 1, ..., 10
+			constexpr double b[] = { 1 / 12., -1 / 720., 1 / 30240., -1 / 1209600., 1 / 47900160.,
+				-5.284190138687493e-10, 1.3382536530684679e-11, -3.3896802963225827e-13,
+				8.586062056277845e-15, -2.174868698558062e-16 };
+			const C z2 = z * z;
+			C h1 = 0, h2 = 0;
+			// terms after k are below (z/2pi)^2k relative
+			for (size_t k = std::fabs(z) < 0.125 ? 5 : std::size(b); k--; ) {
+				h1 = h1 * z2 + b[k];
+				h2 = h2 * z2 + (2 * k + 1) * b[k];
+			}
+
+			return { h1 * z - C(0.5), h2 };
+		}
+		const C sh = std::sinh(z / 2);
+
+		return { 1 / std::expm1(z) - 1 / z, 1 / (z * z) - 1 / (4 * sh * sh) };
+	}
+
+	// Sums S_j = sum_{k < n} k^j q^k for j = 0, 1, 2 where q = exp(-x).
+	// S_0 = n exp(h(n x) - h(x)), S_1 = -S_0' and S_2 = S_0'' in closed form for all n x.
+	template<class C>
+	inline std::array<C, 3> geometric_sums(C x, size_t n)
+	{
+		const C n_ = C(n);
+		const C S0 = x == 0 ? n_ : std::expm1(-n_ * x) / std::expm1(-x);
+		const auto [h1, h2] = geometric_log_derivatives(x);
+		const auto [hn1, hn2] = geometric_log_derivatives(n_ * x);
+		const C m1 = h1 - n_ * hn1; // S_1/S_0
+		const C m2 = n_ * n_ * hn2 - h2; // S_2/S_0 - (S_1/S_0)^2
+
+		return { S0, S0 * m1, S0 * (m1 * m1 + m2) };
+	}
+
+	// Present value, duration, and convexity of a regular instrument at constant yield y in O(1).
+	template<class U, class C>
+	inline risk_measures<C> risk(const instrument::regular<U, C>& r, C y)
+	{
+		const auto [S0, S1, S2] = geometric_sums<C>(y * r.du, r.n);
+		const C D = std::exp(-y * r.u);
+		const U un = r.maturity();
+		const C Dn = std::exp(-y * un);
+
+		risk_measures<C> m;
+		m.present = r.c * D * S0 + r.p * Dn;
+		m.duration = -(r.c * D * (r.u * S0 + r.du * S1) + r.p * un * Dn);
+		m.convexity = r.c * D * (r.u * r.u * S0 + 2 * r.u * r.du * S1 + r.du * r.du * S2) + r.p * un * un * Dn;
+		if (r.cs != 0) {
+			const C Ds = r.cs * std::exp(-y * r.us);
+			m.present += Ds;
+			m.duration -= r.us * Ds;
+			m.convexity += r.us * r.us * Ds;
+		}
+		m.macaulay_duration = m.duration / m.present;
+
+		return m;
+	}
+	// Present value of a regular instrument at constant yield y.
+	template<class U, class C>
+	inline C price(const instrument::regular<U, C>& r, C y)
+	{
+		const C x = y * r.du;
+		const C S0 = std::fabs(r.n * x) < math::epsilon<C> ? C(r.n) : std::expm1(-C(r.n) * x) / std::expm1(-x);
+		C pv = r.c * std::exp(-y * r.u) * S0 + r.p * std::exp(-y * r.maturity());
+		if (r.cs != 0) {
+			pv += r.cs * std::exp(-y * r.us);
+		}
+
+		return pv;
+	}
+
+	// Present value, duration, and convexity of a regular instrument on a piecewise flat curve.
+	// Coupons in each segment are a geometric series from the discount at the first one,
+	// so the cost is proportional to the number of segments spanned.
+	template<class U, class C, class T, class F>
+	inline risk_measures<F> risk(const instrument::regular<U, C>& r, const curve::pwflat<T, F>& f)
+	{
+		risk_measures<F> m;
+		auto D = f.cursor();
+
+		if (r.cs != 0) {
+			const F Ds = r.cs * D.discount(r.us);
+			m.present += Ds;
+			m.duration -= r.us * Ds;
+			m.convexity += r.us * r.us * Ds;
+		}
+		for (size_t j = 0; j < r.n; ) {
+			const U u = r.u + j * r.du;
+			const F Dj = r.c * D.discount(u);
+			const F fj = D.forward(u);
+			// coupons at or before the end of the segment
+			const T t = D.stop();
+			const size_t n = (r.du == 0 || t == math::infinity<T>) ? r.n - j
+				: std::min(r.n - j, static_cast<size_t>((t - u) / r.du) + 1);
+			const auto [S0, S1, S2] = geometric_sums<F>(fj * r.du, n);
+			m.present += Dj * S0;
+			m.duration -= Dj * (u * S0 + r.du * S1);
+			m.convexity += Dj * (u * u * S0 + 2 * u * r.du * S1 + r.du * r.du * S2);
+			j += n;
+		}
+		if (r.p != 0) {
+			const U un = r.maturity();
+			const F Dn = r.p * D.discount(un);
+			m.present += Dn;
+			m.duration -= un * Dn;
+			m.convexity += un * un * Dn;
+		}
+		m.macaulay_duration = m.duration / m.present;
+
+		return m;
+	}
+	template<class U, class C, class T, class F>
+	inline F present(const instrument::regular<U, C>& r, const curve::pwflat<T, F>& f)
+	{
+		return risk(r, f).present;
+	}
+
+	// Price at constant yield y using a geometric series if cash flows are regular.
+	// Detection stops at the first irregular payment. Use instrument::table to detect once for repeated calls.
 	template<class IU, class IC,
 		class C = typename IC::value_type, class U = typename IU::value_type>
 	inline C price(instrument::iterable<IU, IC> i, C y)
 	{
-		return present(i, curve::constant<U, C>(y));
+		if constexpr (std::is_floating_point_v<C>) {
+			if (const auto r = instrument::make_regular(i)) {
+				return price(*r, y);
+			}
+		}
+
+		return present(i, curve::crtp::constant<U, C>(y));
+	}
+
+	// Risk measures at constant yield y using a geometric series if cash flows are regular.
+	// Detection stops at the first irregular payment. Use instrument::table to detect once for repeated calls.
+	template<class IU, class IC,
+		class C = typename IC::value_type, class U = typename IU::value_type>
+		requires (!curve::forward_curve<C>)
+	inline risk_measures<C> risk(instrument::iterable<IU, IC> i, C y)
+	{
+		if constexpr (std::is_floating_point_v<C>) {
+			if (const auto r = instrument::make_regular(i)) {
+				return risk(*r, y);
+			}
+		}
+
+		return risk(i, curve::crtp::constant<U, C>(y));
 	}
 
 	// Constant yield matching price p.
+	// Regular cash flows are detected once and each iteration is O(1).
 	template<class IU, class IC, 
 		class C = typename IC::value_type, class U = typename IU::value_type>
 	inline C yield(instrument::iterable<IU, IC> i, C p = 0,
 		C y0 = 0.01, C tol = 1e4*math::epsilon<C>, int iter = 100)
 	{
-		const auto pv = [p,&i](C y_) { return present(i, curve::constant<U, C>(y_)) - p; };
+		if constexpr (std::is_floating_point_v<C>) {
+			if (const auto r = instrument::make_regular(i)) {
+				const auto pv = [p, &r](C y_) { return price(*r, y_) - p; };
+
+				return std::get<0>(root1d::secant(y0, y0 + 0.1, tol, iter).solve(pv));
+			}
+		}
+
+		const auto pv = [p,&i](C y_) { return present(i, curve::crtp::constant<U, C>(y_)) - p; };
 
 		auto [y, t, n] = root1d::secant(y0, y0 + 0.1, tol, iter).solve(pv);
+		// One Newton step at the root gives tangents dy = -dpv/(dpv/dy) by the implicit function theorem.
+		if constexpr (math::is_dual_v<C>) {
+			y -= pv(y) / duration(i, curve::crtp::constant<U, C>(y));
+		}
 
 		return y;
 	}
 
 	// Constant spread for which the present value of the instrument equals price.
-	template<class IU, class IC, class T, class F>
-	inline F oas(instrument::iterable<IU, IC> i, const curve::interface<T, F>& f, F p,
+	// For adjoint rates the solver iterations are not recorded. The spread is one node with
+	// ds = -dpv/(dpv/ds) at the root by the implicit function theorem.
+	template<class IU, class IC, curve::forward_curve Curve, class F = typename Curve::rate_type>
+	inline F oas(instrument::iterable<IU, IC> i, const Curve& f, F p,
 		F s0 = 0, F tol = math::sqrt_epsilon<F>, int iter = 100)
 	{
-		const auto pv = [p,&i,&f](F s_) { return present(i, f + curve::constant<T,F>(s_)) - p; };
+		const auto solve = [&](const auto& g) {
+			if constexpr (math::is_adjoint_v<F>) {
+				using X = typename F::value_type;
+				ENSURE(math::tape<X>::active() || !"oas: no active tape");
+				auto& tape = *math::tape<X>::active();
+				const size_t m = tape.mark();
+				const auto pv = [p, &i, &g, &tape, m](X s_) {
+					const X v = (present(i, g + F(s_)) - p).value();
+					tape.rewind(m);
 
-		auto [s, t, n] = root1d::secant(s0, s0 + .01, tol, iter).solve(pv);
+					return v;
+				};
 
-		return s;
+				auto [s, t, n] = root1d::secant(s0.value(), s0.value() + .01, tol.value(), iter).solve(pv);
+				const auto g_ = g + F(s);
+				const X dpv = duration(i, g_).value();
+
+				return tape.collapse(m, s - (present(i, g_) - p) / dpv);
+			}
+			else {
+				const auto pv = [p, &i, &g](F s_) { return present(i, g + s_) - p; };
+
+				auto [s, t, n] = root1d::secant(s0, s0 + .01, tol, iter).solve(pv);
+
+				return s;
+			}
+		};
+
+		// Evaluate one owning curve instead of every layer of f in the solver loop.
+		using T = typename Curve::time_type;
+		if constexpr (std::is_base_of_v<curve::pwflat<T, F>, Curve>) {
+			return solve(curve::crtp::pwflat<T, F>(f));
+		}
+		else if constexpr (std::is_base_of_v<curve::interface<T, F>, Curve>) {
+			if (std::vector<T> t; f.breaks(t)) {
+				const auto g = curve::flatten<T, F>(f, std::move(t));
+
+				return solve(curve::crtp::pwflat(g));
+			}
+		}
+
+		return solve(f);
 	}
 
-	// Par coupon for which the present value of the instrument equals 1.
-	template<class IU, class IC, class T, class F>
-	inline F par(T maturity, unsigned frequency, F y0 = 0.03,
-		F tol = math::sqrt_epsilon<F>, int iter = 100)
+	// Coupon of instrument::simple(maturity, coupon, frequency) having price 1 at constant yield y.
+	template<class T, class F>
+	inline F par(T maturity, unsigned frequency, F y)
+	{
+		const size_t n = static_cast<size_t>(maturity * frequency);
+		const T du = T(1) / frequency;
+		// 1 = coupon/frequency sum_{k <= n} D(k du) + D(maturity)
+		const instrument::regular<T, F> annuity{ du, du, n, F(1), F(0) };
+
+		return frequency * -std::expm1(-y * maturity) / price(annuity, y);
+	}
+
+	// Valuation of fixed size instruments with loops of known length.
+	template<size_t N, class U, class C, curve::forward_curve Curve>
+	constexpr auto present(const instrument::fixed<N, U, C>& i, const Curve& f)
+	{
+		decltype(C{} * typename Curve::rate_type{}) pv = 0;
+		for (size_t k = 0; k < N; ++k) {
+			pv += i.c[k] * f.discount(i.u[k]);
+		}
+
+		return pv;
+	}
+	template<size_t N, class U, class C, curve::forward_curve Curve>
+	constexpr auto duration(const instrument::fixed<N, U, C>& i, const Curve& f)
+	{
+		decltype(C{} * typename Curve::rate_type{}) dur = 0;
+		for (size_t k = 0; k < N; ++k) {
+			dur -= i.u[k] * i.c[k] * f.discount(i.u[k]);
+		}
+
+		return dur;
+	}
+	template<size_t N, class U, class C, curve::forward_curve Curve>
+	constexpr auto risk(const instrument::fixed<N, U, C>& i, const Curve& f)
+	{
+		risk_measures<decltype(C{} * typename Curve::rate_type{})> r;
+		for (size_t k = 0; k < N; ++k) {
+			const auto cD = i.c[k] * f.discount(i.u[k]);
+			r.present += cD;
+			r.duration -= i.u[k] * cD;
+			r.convexity += i.u[k] * i.u[k] * cD;
+		}
+		r.macaulay_duration = r.duration / r.present;
+
+		return r;
+	}
+
+	// Coupon of instrument::fixed_simple<Years, Freq> having price 1 on the curve f.
+	// 1 = coupon/Freq sum_{k <= n} D(k/Freq) + D(Years)
+	template<unsigned Years, unsigned Freq = 2, curve::forward_curve Curve>
+	constexpr auto par(const Curve& f)
+	{
+		using F = typename Curve::rate_type;
+		using T = typename Curve::time_type;
+
+		F annuity = 0;
+		for (unsigned k = 1; k <= Years * Freq; ++k) {
+			annuity += f.discount(T(k) / Freq);
+		}
+
+		return Freq * (1 - f.discount(T(Years))) / annuity;
+	}
+
+	// Valuation of materialized cash flows. Regular schedules use geometric series when possible.
+	template<class U, class C, curve::forward_curve Curve>
+	inline auto present(const instrument::table<U, C>& t, const Curve& f)
+	{
+		if constexpr (std::is_same_v<C, typename Curve::rate_type>
+			&& std::is_base_of_v<curve::interface<typename Curve::time_type, C>, Curve>) {
+			return present(t.time(), t.cash(), static_cast<const curve::interface<typename Curve::time_type, C>&>(f));
+		}
+		else {
+			return present(t.view(), f);
+		}
+	}
+	template<class U, class C, class T, class F>
+	inline auto present(const instrument::table<U, C>& t, const curve::pwflat<T, F>& f)
+	{
+		if constexpr (std::is_floating_point_v<F>) {
+			if (t.regular()) {
+				return present(*t.regular(), f);
+			}
+		}
+
+		return present(t.view(), f);
+	}
+	template<class U, class C, curve::forward_curve Curve>
+	inline auto duration(const instrument::table<U, C>& t, const Curve& f)
+	{
+		return duration(t.view(), f);
+	}
+	template<class U, class C, curve::forward_curve Curve>
+	inline auto convexity(const instrument::table<U, C>& t, const Curve& f)
+	{
+		return convexity(t.view(), f);
+	}
+	template<class U, class C, curve::forward_curve Curve>
+	inline auto risk(const instrument::table<U, C>& t, const Curve& f)
+	{
+		return risk(t.view(), f);
+	}
+	template<class U, class C, class T, class F>
+	inline auto risk(const instrument::table<U, C>& t, const curve::pwflat<T, F>& f)
+	{
+		if constexpr (std::is_floating_point_v<F>) {
+			if (t.regular()) {
+				return risk(*t.regular(), f);
+			}
+		}
+
+		return risk(t.view(), f);
+	}
+	template<class U, class C, class T, class F>
+	inline std::vector<F> key_rate_durations(const instrument::table<U, C>& t, const curve::pwflat<T, F>& f)
+	{
+		return key_rate_durations(t.view(), f);
+	}
+
+	// Price and risk at constant yield y without detecting the schedule again.
+	template<class U, class C>
+	inline C price(const instrument::table<U, C>& t, C y)
 	{
-		const auto pv = [maturity, frequency](F y_) { return price(instrument::simple(maturity, y_, frequency), y_) - 1; };
+		if constexpr (std::is_floating_point_v<C>) {
+			if (t.regular()) {
+				return price(*t.regular(), y);
+			}
+		}
 
-		auto [s, t, n] = root1d::secant(y0, y0 + .01, tol, iter).solve(pv);
+		return present(t.view(), curve::crtp::constant<U, C>(y));
+	}
+	template<class U, class C>
+		requires (!curve::forward_curve<C>)
+	inline risk_measures<C> risk(const instrument::table<U, C>& t, C y)
+	{
+		if constexpr (std::is_floating_point_v<C>) {
+			if (t.regular()) {
+				return risk(*t.regular(), y);
+			}
+		}
+
+		return risk(t.view(), curve::crtp::constant<U, C>(y));
+	}
+	template<class U, class C>
+	inline C yield(const instrument::table<U, C>& t, C p = 0,
+		C y0 = 0.01, C tol = 1e4 * math::epsilon<C>, int iter = 100)
+	{
+		if constexpr (std::is_floating_point_v<C>) {
+			if (t.regular()) {
+				const auto pv = [p, &t](C y_) { return price(*t.regular(), y_) - p; };
+
+				return std::get<0>(root1d::secant(y0, y0 + 0.1, tol, iter).solve(pv));
+			}
+		}
 
-		return s;
+		return yield(t.view(), p, y0, tol, iter);
+	}
+
+	// Option adjusted spread discounting each cash flow once.
+	// Iterations only need c D(u) exp(-s u).
+	template<class U, class C, curve::forward_curve Curve, class F = typename Curve::rate_type>
+	inline F oas(const instrument::table<U, C>& t, const Curve& f, F p,
+		F s0 = 0, F tol = math::sqrt_epsilon<F>, int iter = 100)
+	{
+		if constexpr (std::is_floating_point_v<F>) {
+			std::vector<F> cD(t.size());
+			for (size_t k = 0; k < cD.size(); ++k) {
+				cD[k] = t.cash()[k] * f.discount(t.time()[k]);
+			}
+			const auto pv = [p, &t, &cD](F s_) {
+				F v = -p;
+				for (size_t k = 0; k < cD.size(); ++k) {
+					v += cD[k] * std::exp(-s_ * t.time()[k]);
+				}
+
+				return v;
+			};
+
+			return std::get<0>(root1d::secant(s0, s0 + .01, tol, iter).solve(pv));
+		}
+		else {
+			return oas(t.view(), f, p, s0, tol, iter);
+		}
 	}
 
 #ifdef _DEBUG
@@ -212,6 +809,364 @@ namespace tmx::value {
 			auto s0 = value::oas(i, c, pvs);
 			assert(fabs(s0 - s) < math::sqrt_epsilon<double>);
 		}
+		{
+			const double t[] = { 1, 2, 3 };
+			const double r[] = { .01, .02, .03 };
+			const curve::pwflat<> f(3, t, r);
+			const auto g = curve::translate(f, .5);
+			const auto b = curve::bump(.01, 1., 2.);
+			const auto gb = g + b;
+			const auto i = instrument::zero_coupon_bond(2.);
+			double s = 0.02;
+			auto pvs = value::present(i, gb + s);
+			auto s0 = value::oas(i, gb, pvs);
+			assert(fabs(s0 - s) < math::sqrt_epsilon<double>);
+		}
+		{
+			auto i = instrument::zero_coupon_bond(1.);
+			const auto c = curve::crtp::constant(0.05);
+			double s = 0.02;
+			auto pvs = value::present(i, c + s);
+			assert(pvs == value::present(i, curve::constant(0.05) + s));
+			auto s0 = value::oas(i, c, pvs);
+			assert(fabs(s0 - s) < math::sqrt_epsilon<double>);
+		}
+		{
+			const double u[] = { 0.5, 1, 1.5, 2 };
+			const double c[] = { .025, .025, .025, 1.025 };
+			const auto f = curve::constant(0.05);
+			auto i = instrument::iterable(array(u), array(c));
+			const auto pv = value::present(std::span<const double>(u), std::span<const double>(c), f);
+			assert(fabs(pv - value::present(i, f)) <= math::epsilon<double>);
+		}
+		{
+			const double t[] = { 1, 2, 3 };
+			const double r[] = { .01, .02, .03 };
+			const curve::pwflat<> f(3, t, r);
+			const curve::interface<>& f_ = f;
+			const double u[] = { 0.5, 1, 1.5, 2, 2.5, 3 };
+			const double c[] = { .025, .025, .025, .025, .025, 1.025 };
+			const auto i = instrument::iterable(array(u), array(c));
+			assert(fabs(value::present(i, f) - value::present(i, f_)) <= 2 * math::epsilon<double>);
+			assert(fabs(value::duration(i, f) - value::duration(i, f_)) <= 8 * math::epsilon<double>);
+			assert(fabs(value::convexity(i, f) - value::convexity(i, f_)) <= 32 * math::epsilon<double>);
+		}
+		{
+			const double t[] = { 1, 2, 3 };
+			const double r[] = { .01, .02, .03 };
+			const curve::pwflat<> f(3, t, r);
+			const curve::interface<>& f_ = f;
+			const double u[] = { 0.5, 1, 1.5, 2, 2.5, 3 };
+			const double c[] = { .025, .025, .025, .025, .025, 1.025 };
+			const auto i = instrument::iterable(array(u), array(c));
+			for (const auto& rm : { value::risk(i, f), value::risk(i, f_) }) {
+				assert(fabs(rm.present - value::present(i, f_)) <= 2 * math::epsilon<double>);
+				assert(fabs(rm.duration - value::duration(i, f_)) <= 8 * math::epsilon<double>);
+				assert(fabs(rm.convexity - value::convexity(i, f_)) <= 32 * math::epsilon<double>);
+				assert(fabs(rm.macaulay_duration - value::macaulay_duration(i, f_)) <= 8 * math::epsilon<double>);
+			}
+			const double u2[] = { 0.5, 1 };
+			const double c2[] = { .025, 1.025 };
+			const decltype(i) is[] = { i, instrument::iterable(array(u2), array(c2)) };
+			value::risk_measures<> rs[2];
+			value::risk(std::span<const decltype(i)>(is), f_, std::span<value::risk_measures<>>(rs));
+			assert(rs[0].present == value::risk(i, f_).present);
+			assert(rs[1].duration == value::risk(is[1], f_).duration);
+		}
+		{
+			const double t[] = { 1, 2, 3 };
+			const double r[] = { .01, .02, .03 };
+			const curve::pwflat<> f(3, t, r, .04);
+			const double u[] = { 0.5, 1, 1.5, 2, 2.5, 3, 3.5 };
+			const double c[] = { .025, .025, .025, .025, .025, .025, 1.025 };
+			const auto i = instrument::iterable(array(u), array(c));
+			const auto dv = value::key_rate_durations(i, f);
+			assert(dv.size() == 4);
+			const double h = 1e-6;
+			double sum = 0;
+			for (size_t k = 0; k < 4; ++k) {
+				double r_[] = { .01, .02, .03, .04 };
+				r_[k] += h;
+				const curve::pwflat<> f_(3, t, r_, r_[3]);
+				const double dv_ = (value::present(i, f_) - value::present(i, f)) / h;
+				assert(fabs(dv[k] - dv_) <= 1e-5);
+				sum += dv[k];
+			}
+			// parallel shift
+			assert(fabs(sum - value::duration(i, f)) <= 1e-12);
+
+			const double q[] = { 2, -1 };
+			const decltype(i) is[] = { i, i };
+			const auto dvs = value::key_rate_durations(std::span<const decltype(i)>(is), std::span<const double>(q), f);
+			for (size_t k = 0; k < 4; ++k) {
+				assert(fabs(dvs[k] - dv[k]) <= 1e-12);
+			}
+
+			// one pass with a tangent for each rate gives the same sensitivities
+			using D = math::dual<double, 4>;
+			const D r_[] = { D::variable(.01, 0), D::variable(.02, 1), D::variable(.03, 2) };
+			const curve::pwflat<double, D> g(3, t, r_, D::variable(.04, 3));
+			const D pv = value::present(instrument::iterable(array(u), array(c)), g);
+			assert(fabs(pv.value() - value::present(i, f)) <= 1e-15);
+			for (size_t k = 0; k < 4; ++k) {
+				assert(fabs(pv.derivative(k) - dv[k]) <= 1e-12);
+			}
+			// through the interface
+			const curve::interface<double, D>& g_ = g;
+			assert(fabs(g_.discount(2.5).derivative(1) + f.discount(2.5)) <= 1e-15);
+
+			// dy/dp = 1/(dp/dy)
+			using D1 = math::dual<double>;
+			const D1 p = D1::variable(value::present(i, f));
+			const D1 y = value::yield(i, p);
+			const double y_ = value::yield(i, p.value());
+			assert(fabs(y.value() - y_) <= 1e-12);
+			assert(fabs(y.derivative() - 1 / value::duration(i, curve::constant(y_))) <= 1e-9);
+		}
+		{
+			// geometric series match summing cash flows
+			for (size_t n : { 1, 2, 7, 60, 360 }) {
+				std::vector<double> u, c;
+				u.push_back(.1); // stub
+				c.push_back(.003);
+				for (size_t k = 1; k <= n; ++k) {
+					u.push_back(.1 + k / 12.);
+					c.push_back(.004);
+				}
+				u.push_back(u.back());
+				c.push_back(1);
+				const auto i = instrument::iterable(make_interval(u), make_interval(c));
+				const auto r = instrument::make_regular(i);
+				assert(r && (n == 1 || (r->n == n && r->cs == .003))); // two payments are always regular
+				for (double y : { -.01, 0., 1e-6, .001, .03, .2 }) {
+					const auto m = value::risk(*r, y);
+					const auto m_ = value::risk(i, curve::crtp::constant(y));
+					assert(fabs(m.present - m_.present) <= 1e-13 * m_.present);
+					assert(fabs(m.duration - m_.duration) <= 1e-12 * fabs(m_.duration));
+					assert(fabs(m.convexity - m_.convexity) <= 1e-12 * m_.convexity);
+					assert(fabs(value::price(*r, y) - m_.present) <= 1e-13 * m_.present);
+					assert(value::price(i, y) == value::price(*r, y));
+				}
+				const double p = value::present(i, curve::constant(.04));
+				assert(fabs(value::yield(i, p) - .04) <= 1e-10);
+			}
+			// segment-wise on piecewise flat curves
+			{
+				const double t[] = { .25, 1, 2.5, 5, 10, 30 };
+				const double r[] = { .01, .015, .02, .03, .035, .04 };
+				for (const curve::pwflat<>& f : { curve::pwflat<>(6, t, r), curve::pwflat<>(6, t, r, .05), curve::pwflat<>(.02) }) {
+					for (size_t n : { 1, 12, 120, 360 }) {
+						for (double du : { 1 / 12., .5 }) {
+							std::vector<double> u, c;
+							u.push_back(du / 3); // stub
+							c.push_back(.001);
+							for (size_t k = 1; k <= n && k * du <= 30; ++k) {
+								u.push_back(k * du);
+								c.push_back(.004 + (k == n || (k + 1) * du > 30));
+							}
+							const auto i = instrument::iterable(make_interval(u), make_interval(c));
+							const auto rg = instrument::make_regular(i);
+							assert(rg);
+							const auto m = value::risk(*rg, f);
+							const auto m_ = value::risk(i, f);
+							assert(fabs(m.present - m_.present) <= 1e-13 * m_.present);
+							assert(fabs(m.duration - m_.duration) <= 1e-12 * fabs(m_.duration));
+							assert(fabs(m.convexity - m_.convexity) <= 1e-12 * m_.convexity);
+						}
+					}
+				}
+			}
+			// 30 year monthly bond where n x is small for ordinary yields
+			{
+				std::vector<double> u, c;
+				for (size_t k = 1; k <= 360; ++k) {
+					u.push_back(k / 12.);
+					c.push_back(.03 / 12 + (k == 360));
+				}
+				const auto i_ = instrument::iterable(make_interval(u), make_interval(c));
+				const auto r = instrument::make_regular(i_);
+				assert(r && r->n == 360);
+				for (double y : { .005, .01, .015, .04 }) {
+					const auto m = value::risk(*r, y);
+					const auto m_ = value::risk(i_, curve::crtp::constant(y));
+					assert(fabs(m.present - m_.present) <= 1e-13 * m_.present);
+					assert(fabs(m.duration - m_.duration) <= 1e-13 * fabs(m_.duration));
+					assert(fabs(m.convexity - m_.convexity) <= 1e-13 * m_.convexity);
+				}
+				const double t[] = { 1, 2, 5, 10, 30 };
+				const double f[] = { .005, .008, .01, .012, .015 };
+				const curve::pwflat<> D(5, t, f);
+				const auto m = value::risk(*r, D);
+				const auto m_ = value::risk(i_, D);
+				assert(fabs(m.present - m_.present) <= 1e-13 * m_.present);
+				assert(fabs(m.duration - m_.duration) <= 1e-13 * fabs(m_.duration));
+				assert(fabs(m.convexity - m_.convexity) <= 1e-13 * m_.convexity);
+			}
+			// fixed size instruments
+			{
+				const double t[] = { 1, 2, 5, 10 };
+				const double r[] = { .02, .025, .03, .035 };
+				const curve::pwflat<> f(4, t, r, .04);
+				const auto i = instrument::fixed_simple<10>(.05);
+				std::vector<double> u, c;
+				for (size_t k = 0; k < i.size(); ++k) {
+					u.push_back(i.u[k]);
+					c.push_back(i.c[k]);
+				}
+				const auto i_ = instrument::iterable(make_interval(u), make_interval(c));
+				assert(fabs(value::present(i, f) - value::present(i_, f)) <= 1e-14);
+				assert(fabs(value::duration(i, f) - value::duration(i_, f)) <= 1e-13);
+				assert(fabs(value::risk(i, f).convexity - value::risk(i_, f).convexity) <= 1e-12);
+
+				const double p = value::par<10>(f);
+				assert(fabs(value::present(instrument::fixed_simple<10>(p), f) - 1) <= 1e-14);
+				for (double y : { .01, .05 }) {
+					const auto fy = curve::crtp::constant<double, double>(y);
+					assert(fabs(value::par<5, 4>(fy) - value::par(5., 4, y)) <= 1e-14);
+				}
+			}
+			// materialized cash flows
+			{
+				const double t[] = { 1, 2, 5, 10 };
+				const double r[] = { .02, .025, .03, .035 };
+				const curve::pwflat<> f(4, t, r, .04);
+				const auto check = [&f](auto i) {
+					const auto tb = instrument::table(i);
+					const double eps = 1e-13;
+					assert(fabs(value::present(tb, f) - value::present(i, f)) <= eps);
+					assert(fabs(value::present(tb, curve::constant(.03)) - value::present(i, curve::constant(.03))) <= eps);
+					assert(fabs(value::duration(tb, f) - value::duration(i, f)) <= 10 * eps);
+					assert(fabs(value::risk(tb, f).convexity - value::risk(i, f).convexity) <= 100 * eps);
+					assert(value::key_rate_durations(tb, f) == value::key_rate_durations(i, f));
+					assert(fabs(value::price(tb, .03) - value::price(i, .03)) <= eps);
+					assert(fabs(value::risk(tb, .03).duration - value::risk(i, .03).duration) <= 10 * eps);
+					const double p = value::present(i, f + .01);
+					assert(fabs(value::yield(tb, p) - value::yield(i, p)) <= 1e-10);
+					assert(fabs(value::oas(tb, f, p) - .01) <= 1e-10);
+				};
+				for (auto [n, du] : { std::pair(20, .5), std::pair(29, .25) }) {
+					std::vector<double> u, c;
+					for (int k = 1; k <= n; ++k) {
+						u.push_back(k * du);
+						c.push_back(.025 * du + (k == n));
+					}
+					check(instrument::iterable(make_interval(u), make_interval(c)));
+				}
+				const double u[] = { .5, 1, 2, 3.5 };
+				const double c[] = { .02, .02, .03, 1.02 };
+				check(instrument::iterable(array(u), array(c)));
+			}
+			// par coupon
+			for (double y : { 0.001, .03, .1 }) {
+				const double cpn = value::par(10., 2, y);
+				std::vector<double> u, c;
+				for (size_t k = 1; k <= 20; ++k) {
+					u.push_back(k / 2.);
+					c.push_back(cpn / 2 + (k == 20));
+				}
+				const auto i = instrument::iterable(make_interval(u), make_interval(c));
+				assert(fabs(value::present(i, curve::constant(y)) - 1) <= 1e-14);
+			}
+		}
+		{
+			// exact Hessian block of present value with respect to the rates on (1, 2] and (2, 3]
+			const double t[] = { 1, 2, 3 };
+			const double r[] = { .01, .02, .03, .04 };
+			const curve::pwflat<> f(3, t, r, r[3]);
+			const double u[] = { 0.5, 1, 1.5, 2, 2.5, 3, 3.5 };
+			const double c[] = { .025, .025, .025, .025, .025, .025, 1.025 };
+			const auto i = instrument::iterable(array(u), array(c));
+			const auto dv = value::key_rate_durations(i, f);
+
+			using H = math::hyperdual<double, 2>;
+			const H r_[] = { H(r[0]), H::variable(r[1], 0), H::variable(r[2], 1) };
+			const curve::pwflat<double, H> g(3, t, r_, H(r[3]));
+			const H pv = value::present(i, g);
+			assert(fabs(pv.value() - value::present(i, f)) <= 1e-15);
+			assert(fabs(pv.gradient(0) - dv[1]) <= 1e-14);
+			assert(fabs(pv.gradient(1) - dv[2]) <= 1e-14);
+			// d^2 pv/df_j df_k = sum c D(u) |(t[j-1], t[j]] ∩ (0, u]| |(t[k-1], t[k]] ∩ (0, u]|
+			const double h = 1e-6;
+			for (size_t j = 0; j < 2; ++j) {
+				double rh[] = { .01, .02, .03, .04 };
+				rh[j + 1] += h;
+				const auto dv_ = value::key_rate_durations(i, curve::pwflat<>(3, t, rh, rh[3]));
+				for (size_t k = 0; k < 2; ++k) {
+					assert(fabs(pv.hessian(j, k) - (dv_[k + 1] - dv[k + 1]) / h) <= 1e-5);
+				}
+			}
+			assert(fabs(pv.hessian(0, 0) - (.025 * f.discount(1.5) * .25 + .025 * (f.discount(2) + f.discount(2.5) + f.discount(3)) + 1.025 * f.discount(3.5))) <= 1e-15);
+		}
+		{
+			// reverse mode gradient with respect to every rate
+			const double t[] = { 1, 2, 3 };
+			const double r[] = { .01, .02, .03, .04 };
+			const curve::pwflat<> f(3, t, r, r[3]);
+			const double u[] = { 0.5, 1, 1.5, 2, 2.5, 3, 3.5 };
+			const double c[] = { .025, .025, .025, .025, .025, .025, 1.025 };
+			const auto i = instrument::iterable(array(u), array(c));
+			const auto dv = value::key_rate_durations(i, f);
+
+			using A = math::adjoint<>;
+			math::tape<> tape;
+			const A r_[] = { A::variable(r[0]), A::variable(r[1]), A::variable(r[2]), A::variable(r[3]) };
+			const curve::pwflat<double, A> g(3, t, r_, r_[3]);
+			const A pv = 2 * value::present(i, g) - value::present(i, g);
+			tape.gradient(pv);
+			for (size_t k = 0; k < 4; ++k) {
+				assert(fabs(tape.derivative(r_[k]) - dv[k]) <= 1e-12);
+			}
+
+			// oas adjoint matches bumping the curve
+			const double p = value::present(i, f) - .01;
+			const double s = value::oas(i, f, p);
+			const size_t m = tape.size();
+			assert(fabs(value::oas(i, curve::crtp::pwflat(g), A(p)).value() - s) <= 1e-8);
+			assert(tape.size() == m + 1); // solver iterations are not recorded
+			const A s_ = value::oas(i, g, A(p));
+			assert(fabs(s_.value() - s) <= 1e-8);
+			tape.gradient(s_);
+			const double h = 1e-6;
+			for (size_t k = 0; k < 4; ++k) {
+				double rh[] = { .01, .02, .03, .04 };
+				rh[k] += h;
+				const double ds = (value::oas(i, curve::pwflat<>(3, t, rh, rh[3]), p) - s) / h;
+				assert(fabs(tape.derivative(r_[k]) - ds) <= 1e-4);
+			}
+		}
+		{
+			// no extrapolation when the last knot is past the last cash flow
+			const double t[] = { 1, 2, 4 };
+			const double r[] = { .01, .02, .03 };
+			const curve::pwflat<> f(3, t, r);
+			const double u[] = { 0.5, 1, 1.5, 2, 2.5, 3, 3.5 };
+			const double c[] = { .025, .025, .025, .025, .025, .025, 1.025 };
+			const auto i = instrument::iterable(array(u), array(c));
+			const auto dv = value::key_rate_durations(i, f);
+
+			using A = math::adjoint<>;
+			{
+				math::tape<> tape;
+				const A r_[] = { A::variable(r[0]), A::variable(r[1]), A::variable(r[2]) };
+				const curve::pwflat<double, A> g(3, t, r_);
+				assert(math::isnan(g.extrapolation().value()));
+				const A pv = value::present(i, g);
+				assert(pv.value() == value::present(i, f));
+				tape.gradient(pv);
+				for (size_t k = 0; k < 3; ++k) {
+					assert(fabs(tape.derivative(r_[k]) - dv[k]) <= 1e-12);
+				}
+				assert(dv[3] == 0);
+			}
+			// adjoint oas needs a tape
+			const A r_[] = { A(r[0]), A(r[1]), A(r[2]) };
+			try {
+				value::oas(i, curve::pwflat<double, A>(3, t, r_), A(value::present(i, f)));
+				assert(false);
+			}
+			catch (const std::runtime_error&) {
+			}
+		}
 
 		return 0;
 	}
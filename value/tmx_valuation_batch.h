@@ -0,0 +1,472 @@
+// tmx_valuation_batch.h - Valuation of many instruments stored in columns.
+// Solvers run a fixed number of instruments in lanes so the inner loops
+// over cash flows have no data dependent control flow. The exp loop only
+// vectorizes if the compiler has a vector exp, e.g., gcc -O3 -ffast-math.
+#pragma once
+#ifdef _DEBUG
+#include <cassert>
+#endif // _DEBUG
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <span>
+#include <type_traits>
+#include <vector>
+#include "ensure.h"
+#include "math/tmx_math.h"
+#include "curve/tmx_curve.h"
+#include "curve/tmx_curve_pwflat.h"
+#include "instrument/tmx_instrument_columns.h"
+#include "instrument/tmx_instrument_portfolio.h"
+#include "value/tmx_valuation.h"
+
+namespace tmx::value {
+
+	// Instruments solved together.
+	constexpr size_t batch_lanes = 8;
+
+	// Iterations and convergence of one instrument in a batch solve.
+	struct solve_status {
+		unsigned iterations = 0;
+		bool converged = false;
+	};
+
+	// Discount function for the non-decreasing times of one instrument.
+	template<curve::forward_curve Curve>
+	inline auto discounter(const Curve& f)
+	{
+		return [&f](typename Curve::time_type u) { return f.discount(u); };
+	}
+	// Piecewise flat curves use a cursor.
+	template<class T, class F>
+	inline auto discounter(const curve::pwflat<T, F>& f)
+	{
+		return [D = f.cursor()](T u) mutable { return D.discount(u); };
+	}
+
+	// Present value pv[j] of each instrument in cf.
+	template<class U, class C, curve::forward_curve Curve>
+	inline void present(const instrument::columns<U, C>& cf, const Curve& f, std::span<C> pv)
+	{
+		ENSURE(pv.size() == cf.size());
+
+		for (size_t j = 0; j < cf.size(); ++j) {
+			auto D = discounter(f);
+			C pv_ = 0;
+			for (size_t k = cf.offset[j]; k < cf.offset[j + 1]; ++k) {
+				pv_ += cf.c[k] * D(cf.u[k]);
+			}
+			pv[j] = pv_;
+		}
+	}
+
+	// Risk measures rs[j] of each instrument in cf in one pass over the cash flows.
+	template<class U, class C, curve::forward_curve Curve>
+	inline void risk(const instrument::columns<U, C>& cf, const Curve& f, std::span<risk_measures<C>> rs)
+	{
+		ENSURE(rs.size() == cf.size());
+
+		for (size_t j = 0; j < cf.size(); ++j) {
+			auto D = discounter(f);
+			risk_measures<C> r;
+			for (size_t k = cf.offset[j]; k < cf.offset[j + 1]; ++k) {
+				const U u = cf.u[k];
+				const C cD = cf.c[k] * D(u);
+				r.present += cD;
+				r.duration -= u * cD;
+				r.convexity += u * u * cD;
+			}
+			r.macaulay_duration = r.duration / r.present;
+			rs[j] = r;
+		}
+	}
+	// Risk measures of a portfolio holding quantity q[j] of instrument j.
+	template<class U, class C, curve::forward_curve Curve>
+	inline risk_measures<C> risk(const instrument::columns<U, C>& cf, const Curve& f, std::span<const C> q)
+	{
+		ENSURE(q.size() == cf.size());
+
+		risk_measures<C> r;
+		for (size_t j = 0; j < cf.size(); ++j) {
+			auto D = discounter(f);
+			for (size_t k = cf.offset[j]; k < cf.offset[j + 1]; ++k) {
+				const U u = cf.u[k];
+				const C cD = q[j] * cf.c[k] * D(u);
+				r.present += cD;
+				r.duration -= u * cD;
+				r.convexity += u * u * cD;
+			}
+		}
+		r.macaulay_duration = r.duration / r.present;
+
+		return r;
+	}
+
+	// Spread s[j] with sum_k w[k] exp(-s[j] u[k]) = p[j] over the cash flows k of instruments j in js.
+	// Newton's method using present value and duration from one pass over the cash flows
+	// starting from the values in s. Instruments are taken shortest first and a lane is refilled
+	// with the next one as soon as its instrument converges or fails, so lanes stay busy
+	// and have similar lengths. A lane stops when |pv - p| <= tol.
+	// Spreads that do not converge are NaN. If status is not empty it is set for each instrument.
+	// Return the number of instruments that converged.
+	template<class U, class C>
+	inline size_t spread(const instrument::columns<U, C>& cf, std::span<const C> w, std::span<const C> p, std::span<C> s,
+		std::span<const size_t> js, std::span<solve_status> status = {}, C tol = 1e4 * math::epsilon<C>, unsigned iter = 100)
+	{
+		ENSURE(w.size() == cf.u.size());
+		ENSURE(p.size() == cf.size() && s.size() == cf.size());
+		ENSURE(status.empty() || status.size() == cf.size());
+
+		std::vector<size_t> order(js.begin(), js.end());
+		std::stable_sort(order.begin(), order.end(), [&cf](size_t i, size_t j) { return cf.size(i) < cf.size(j); });
+
+		constexpr size_t L = batch_lanes;
+		size_t converged = 0;
+		size_t next = 0; // next instrument in order
+		size_t m = 0; // most cash flows in a lane
+		// Cash flow i of lane l is at i * L + l with weight 0 past the end of the lane.
+		std::vector<U> u_;
+		std::vector<C> w_;
+		size_t j_[L]; // instrument in lane
+		C s_[L], p_[L], pv[L], dpv[L];
+		bool active[L];
+		unsigned it[L];
+
+		// Put the next instrument in lane l, if any.
+		const auto load = [&](size_t l) {
+			active[l] = next < order.size();
+			const size_t j = active[l] ? order[next++] : 0;
+			const size_t n = active[l] ? cf.size(j) : 0;
+			j_[l] = j;
+			p_[l] = active[l] ? p[j] : 0;
+			s_[l] = active[l] ? s[j] : 0;
+			it[l] = 0;
+			if (n > m) {
+				m = n;
+				u_.resize(m * L, U(0));
+				w_.resize(m * L, C(0));
+			}
+			for (size_t i = 0; i < m; ++i) {
+				u_[i * L + l] = i < n ? cf.u[cf.offset[j] + i] : U(0);
+				w_[i * L + l] = i < n ? w[cf.offset[j] + i] : C(0);
+			}
+		};
+		// Record the result in lane l and refill it.
+		const auto finish = [&](size_t l, bool ok) {
+			const size_t j = j_[l];
+			s[j] = ok ? s_[l] : math::NaN<C>;
+			if (!status.empty()) {
+				status[j].converged = ok;
+				status[j].iterations = it[l];
+			}
+			converged += ok;
+			load(l);
+		};
+
+		for (size_t l = 0; l < L; ++l) {
+			load(l);
+		}
+		while (std::any_of(active, active + L, [](bool a) { return a; })) {
+			for (size_t l = 0; l < L; ++l) {
+				pv[l] = 0;
+				dpv[l] = 0;
+			}
+			for (size_t i = 0; i < m; ++i) {
+				const U* u = u_.data() + i * L;
+				const C* wi = w_.data() + i * L;
+				C D[L];
+				for (size_t l = 0; l < L; ++l) {
+					D[l] = -s_[l] * u[l];
+				}
+				for (size_t l = 0; l < L; ++l) {
+					D[l] = std::exp(D[l]);
+				}
+				for (size_t l = 0; l < L; ++l) {
+					const C wD = wi[l] * D[l];
+					pv[l] += wD;
+					dpv[l] -= u[l] * wD;
+				}
+			}
+			for (size_t l = 0; l < L; ++l) {
+				if (active[l]) {
+					++it[l];
+					const C r = pv[l] - p_[l];
+					if (math::fabs(r) <= tol) {
+						finish(l, true);
+					}
+					else {
+						s_[l] -= r / dpv[l];
+						if (!std::isfinite(s_[l]) || it[l] >= iter) {
+							finish(l, false);
+						}
+					}
+				}
+			}
+		}
+
+		return converged;
+	}
+	// Spreads of all instruments in cf.
+	template<class U, class C>
+	inline size_t spread(const instrument::columns<U, C>& cf, std::span<const C> w, std::span<const C> p, std::span<C> s,
+		std::span<solve_status> status = {}, C tol = 1e4 * math::epsilon<C>, unsigned iter = 100)
+	{
+		std::vector<size_t> js(cf.size());
+		std::iota(js.begin(), js.end(), size_t(0));
+
+		return spread(cf, w, p, s, std::span<const size_t>(js), status, tol, iter);
+	}
+
+	// Constant yield y[j] matching price p[j] starting from y0.
+	// Regular schedules are solved one at a time using geometric series
+	// and the rest in lanes.
+	template<class U, class C>
+	inline size_t yield(const instrument::columns<U, C>& cf, std::span<const C> p, std::span<C> y,
+		std::span<solve_status> status = {}, C y0 = 0.01, C tol = 1e4 * math::epsilon<C>, unsigned iter = 100)
+	{
+		ENSURE(p.size() == cf.size() && y.size() == cf.size());
+		ENSURE(status.empty() || status.size() == cf.size());
+
+		size_t converged = 0;
+		std::vector<size_t> js; // instruments without a regular schedule
+		for (size_t j = 0; j < cf.size(); ++j) {
+			const auto u = cf.time(j);
+			const auto c = cf.cash(j);
+			const auto r = instrument::make_regular(instrument::iterable(fms::iterable::interval(u.data(), u.data() + u.size()),
+				fms::iterable::interval(c.data(), c.data() + c.size())));
+			if (!r) {
+				y[j] = y0;
+				js.push_back(j);
+				continue;
+			}
+			// Newton's method on the geometric series
+			C y_ = y0;
+			unsigned k = 0;
+			bool ok = false;
+			while (!ok && k < iter && std::isfinite(y_)) {
+				++k;
+				const auto m = risk(*r, y_);
+				const C r_ = m.present - p[j];
+				ok = math::fabs(r_) <= tol;
+				if (!ok) {
+					y_ -= r_ / m.duration;
+				}
+			}
+			y[j] = ok ? y_ : math::NaN<C>;
+			if (!status.empty()) {
+				status[j].converged = ok;
+				status[j].iterations = k;
+			}
+			converged += ok;
+		}
+
+		return converged + spread(cf, cf.c, p, y, std::span<const size_t>(js), status, tol, iter);
+	}
+
+	// Option adjusted spread s[j] to the curve f matching price p[j].
+	// Cash flows are discounted once so each iteration only needs D(u) exp(-s u).
+	// On entry s holds starting spreads, e.g., the solution before the curve moved.
+	// Starting spreads that are NaN are replaced by 0.
+	template<class U, class C, curve::forward_curve Curve>
+	inline size_t oas(const instrument::columns<U, C>& cf, const Curve& f, std::span<const C> p, std::span<C> s,
+		std::span<solve_status> status = {}, C tol = 1e4 * math::epsilon<C>, unsigned iter = 100)
+	{
+		std::vector<C> cD(cf.u.size());
+		if constexpr (std::is_base_of_v<curve::interface<typename Curve::time_type, typename Curve::rate_type>, Curve>) {
+			f.discount(cf.u, std::span<C>(cD));
+		}
+		else {
+			for (size_t k = 0; k < cD.size(); ++k) {
+				cD[k] = f.discount(cf.u[k]);
+			}
+		}
+		for (size_t k = 0; k < cD.size(); ++k) {
+			cD[k] *= cf.c[k];
+		}
+		for (C& s_ : s) {
+			if (math::isnan(s_)) {
+				s_ = 0;
+			}
+		}
+
+		return spread(cf, std::span<const C>(cD), p, s, status, tol, iter);
+	}
+
+#ifdef _DEBUG
+	inline int yield_batch_test()
+	{
+		{
+			// bonds with 1 to 20 semiannual coupons at known yields
+			const size_t N = 20;
+			std::vector<size_t> o{ 0 };
+			std::vector<double> u, c, p, y0;
+			for (size_t j = 0; j < N; ++j) {
+				const double cpn = 0.01 + 0.002 * j;
+				const double y = 0.005 + 0.003 * j;
+				double pv = 0;
+				for (size_t k = 1; k <= j + 1; ++k) {
+					u.push_back(0.5 * k);
+					c.push_back(cpn / 2 + (k == j + 1));
+					pv += c.back() * std::exp(-y * u.back());
+				}
+				o.push_back(u.size());
+				p.push_back(pv);
+				y0.push_back(y);
+			}
+			// price no bond can have
+			u.push_back(1);
+			c.push_back(1);
+			o.push_back(u.size());
+			p.push_back(-1);
+
+			const instrument::columns<> cf{ std::span<const size_t>(o), std::span<const double>(u), std::span<const double>(c) };
+			std::vector<double> y(N + 1);
+			std::vector<solve_status> s(N + 1);
+			const size_t n = value::yield(cf, std::span<const double>(p), std::span<double>(y), std::span<solve_status>(s));
+			assert(n == N);
+			for (size_t j = 0; j < N; ++j) {
+				assert(s[j].converged);
+				assert(s[j].iterations < 10);
+				assert(std::fabs(y[j] - y0[j]) <= 1e-10);
+			}
+			assert(!s[N].converged);
+			assert(math::isnan(y[N]));
+		}
+		{
+			// amortizing bonds are not regular and are solved in lanes
+			const size_t N = 29;
+			std::vector<size_t> o{ 0 };
+			std::vector<double> u, c, p, y0;
+			for (size_t j = 0; j < N; ++j) {
+				const size_t n = 2 + (j * 7) % 23; // not sorted by length
+				const double y = 0.005 + 0.002 * j;
+				double pv = 0;
+				for (size_t k = 1; k <= n; ++k) {
+					u.push_back(0.5 * k);
+					c.push_back((1 + 0.02 * (n + 1 - k)) / n); // interest on the outstanding balance
+					pv += c.back() * std::exp(-y * u.back());
+				}
+				o.push_back(u.size());
+				p.push_back(pv);
+				y0.push_back(y);
+			}
+			const instrument::columns<> cf{ std::span<const size_t>(o), std::span<const double>(u), std::span<const double>(c) };
+			assert(!instrument::make_regular(instrument::iterable(fms::iterable::interval(u.data() + o[1], u.data() + o[2]),
+				fms::iterable::interval(c.data() + o[1], c.data() + o[2]))));
+			std::vector<double> y(N);
+			std::vector<solve_status> s(N);
+			const size_t n = value::yield(cf, std::span<const double>(p), std::span<double>(y), std::span<solve_status>(s));
+			assert(n == N);
+			for (size_t j = 0; j < N; ++j) {
+				assert(s[j].converged);
+				assert(s[j].iterations < 10);
+				assert(std::fabs(y[j] - y0[j]) <= 1e-10);
+			}
+			// too few iterations
+			const size_t n_ = value::yield(cf, std::span<const double>(p), std::span<double>(y), std::span<solve_status>(s), 0.01, 1e-12, 1);
+			assert(n_ == 0);
+			assert(!s[N - 1].converged && math::isnan(y[N - 1]));
+		}
+
+		return 0;
+	}
+	inline int risk_batch_test()
+	{
+		{
+			const double t[] = { 1, 2, 5, 10 };
+			const double f[] = { .02, .025, .03, .035 };
+			const curve::pwflat<> D(4, t, f, .04);
+			const auto i = [](size_t j) {
+				using namespace fms::iterable;
+
+				const size_t m = 1 + 3 * j;
+
+				return instrument::iterable(take(sequence(.5, .5), m), take(constant(.02 + .001 * j), m));
+			};
+			const size_t n = 11;
+			const instrument::portfolio<> p(n, i, 3);
+			const auto cf = p.columns();
+
+			std::vector<double> pv(n), q(n);
+			std::vector<risk_measures<>> rs(n);
+			value::present(cf, D, std::span<double>(pv));
+			value::risk(cf, D, std::span<risk_measures<>>(rs));
+			risk_measures<> r_;
+			for (size_t j = 0; j < n; ++j) {
+				const auto r = value::risk(i(j), D);
+				assert(std::fabs(pv[j] - r.present) <= 1e-15);
+				assert(std::fabs(rs[j].present - r.present) <= 1e-15);
+				assert(std::fabs(rs[j].duration - r.duration) <= 1e-14);
+				assert(std::fabs(rs[j].convexity - r.convexity) <= 1e-13);
+				q[j] = j + 1.;
+				r_.present += q[j] * r.present;
+				r_.duration += q[j] * r.duration;
+			}
+			const auto r = value::risk(cf, D, std::span<const double>(q));
+			assert(std::fabs(r.present - r_.present) <= 1e-12);
+			assert(std::fabs(r.duration - r_.duration) <= 1e-11);
+			// netted by time
+			const auto net = instrument::net(cf, std::span<const double>(q), 2);
+			assert(net.size() == 3 * (n - 1) + 1);
+			assert(std::fabs(value::present(net, D) - r.present) <= 1e-12);
+			assert(std::fabs(value::duration(net, D) - r.duration) <= 1e-11);
+			// any forward curve
+			value::present(cf, curve::constant(.03), std::span<double>(pv));
+			assert(std::fabs(pv[n - 1] - value::present(i(n - 1), curve::constant(.03))) <= 1e-15);
+		}
+
+		return 0;
+	}
+	inline int oas_batch_test()
+	{
+		{
+			// bonds with 1 to 40 semiannual coupons at known spreads to a piecewise flat curve
+			const size_t N = 40;
+			const double t[] = { 1, 2, 5, 10 };
+			const double f[] = { .02, .025, .03, .035 };
+			const curve::pwflat<> D(4, t, f, .04);
+			std::vector<size_t> o{ 0 };
+			std::vector<double> u, c, p, s0;
+			for (size_t j = 0; j < N; ++j) {
+				const double s = 0.001 * j;
+				double pv = 0;
+				for (size_t k = 1; k <= j + 1; ++k) {
+					u.push_back(0.5 * k);
+					c.push_back(0.02 + (k == j + 1));
+					pv += c.back() * D.discount(u.back()) * std::exp(-s * u.back());
+				}
+				o.push_back(u.size());
+				p.push_back(pv);
+				s0.push_back(s);
+			}
+
+			const instrument::columns<> cf{ std::span<const size_t>(o), std::span<const double>(u), std::span<const double>(c) };
+			std::vector<double> s(N, math::NaN<double>);
+			std::vector<solve_status> st(N);
+			size_t n = value::oas(cf, D, std::span<const double>(p), std::span<double>(s), std::span<solve_status>(st));
+			assert(n == N);
+			unsigned cold = 0;
+			for (size_t j = 0; j < N; ++j) {
+				assert(st[j].converged);
+				assert(std::fabs(s[j] - s0[j]) <= 1e-10);
+				cold += st[j].iterations;
+			}
+
+			// curve moves 1bp and the previous spreads are a warm start
+			const double f_[] = { .0201, .0251, .0301, .0351 };
+			const curve::pwflat<> D_(4, t, f_, .0401);
+			n = value::oas(cf, D_, std::span<const double>(p), std::span<double>(s), std::span<solve_status>(st));
+			assert(n == N);
+			unsigned warm = 0;
+			for (size_t j = 0; j < N; ++j) {
+				assert(std::fabs(s[j] - (s0[j] - .0001)) <= 1e-10);
+				warm += st[j].iterations;
+			}
+			assert(warm < cold);
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
+} // namespace tmx::value